@@ -0,0 +1,619 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include "quadtree.h"
+#include "free_quadtree.h"
+#include "lock_quadtree.h"
+#include "sharded_quadtree.h"
+#include "filter.h"
+#include "snapshot.h"
+
+namespace
+{
+using std::vector;
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::thread;
+using std::unique_ptr;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using quadtree::BoundingBox;
+using quadtree::Point;
+using quadtree::Quadtree;
+using quadtree::LockfreeQuadtree;
+using quadtree::LockQuadtree;
+using quadtree::ShardedQuadtree;
+using quadtree::Allocation;
+using quadtree::Reclamation;
+using quadtree::Snapshot;
+using quadtree::filter::Kernel;
+
+typedef std::mt19937_64 Rng;
+
+struct Config
+{
+  vector<string> Trees = {"lockfree", "lock"};
+  vector<string> Distributions = {"uniform"};
+  vector<unsigned int> Threads = {1, 2, 4, 8};
+  vector<string> Kernels = {"auto"}; ///< leaf filtering kernels to sweep
+  size_t Capacity = 4;
+  size_t Prefill = 1000000;
+  size_t Ops = 1000000;       ///< timed operations, split across the threads
+  double InsertRatio = 0.9;   ///< the rest are queries
+  double QuerySize = 0.01;    ///< query box half-dimensions, as a fraction of the boundary's
+  string Query = "points";    ///< what a query does: collect the points, count them, or find the nearest
+  size_t K = 8;               ///< points a nearest query looks for
+  size_t Window = 0;          ///< if not 0, each insert past the last Window deletes the oldest of them
+  Allocation Alloc = Allocation::Heap;
+  Reclamation Reclaim = Reclamation::HazardPointer;
+  unsigned int ShardColumns = 4;
+  unsigned int ShardRows = 4;
+  bool Rebalance = false;     ///< rebalance a sharded tree after prefill
+  string Format = "csv";
+  uint64_t Seed = 1;
+};
+
+const BoundingBox BOUNDARY = {{100.0, 100.0}, {50.0, 50.0}};
+
+/// Produces points from one distribution. One per thread; nothing here is shared.
+class PointGenerator
+{
+public:
+  PointGenerator(const string& distribution, uint64_t seed)
+    : rng(seed)
+    , kind(distribution)
+    , unit(0.0, 1.0)
+  {
+    // the shape of the data is the same for every thread, only the draws differ
+    Rng shape(42);
+    if(kind == "clusters")
+    {
+      for(int i = 0; i != 16; ++i)
+        centers.push_back(uniformPoint(shape));
+    }
+    else if(kind == "zipf")
+    {
+      // 1024 hot spots, the k'th drawn with weight 1/k^1.1
+      double total = 0.0;
+      for(int k = 1; k <= 1024; ++k)
+      {
+        centers.push_back(uniformPoint(shape));
+        total += 1.0 / std::pow(k, 1.1);
+        cdf.push_back(total);
+      }
+      for(auto& c : cdf)
+        c /= total;
+    }
+    else if(kind == "duplicates")
+    {
+      for(int i = 0; i != 1024; ++i)
+        centers.push_back(uniformPoint(shape));
+    }
+    else if(kind != "uniform")
+    {
+      cerr << "unknown distribution " << kind << endl;
+      std::exit(1);
+    }
+  }
+
+  Point Next()
+  {
+    if(kind == "clusters")
+    {
+      const Point& c = centers[rng() % centers.size()];
+      std::normal_distribution<double> dx(c.X, BOUNDARY.HalfDimension.X * 0.02);
+      std::normal_distribution<double> dy(c.Y, BOUNDARY.HalfDimension.Y * 0.02);
+      while(true)
+      {
+        const Point p(dx(rng), dy(rng));
+        if(BOUNDARY.Contains(p))
+          return p;
+      }
+    }
+    if(kind == "zipf")
+    {
+      const size_t i = std::lower_bound(cdf.begin(), cdf.end(), unit(rng)) - cdf.begin();
+      const Point& c = centers[std::min(i, centers.size() - 1)];
+      const double spread = BOUNDARY.HalfDimension.X * 0.001;
+      const Point p(c.X + (unit(rng) - 0.5) * spread, c.Y + (unit(rng) - 0.5) * spread);
+      return BOUNDARY.Contains(p) ? p : c;
+    }
+    if(kind == "duplicates")
+      return centers[rng() % centers.size()];
+    return uniformPoint(rng);
+  }
+
+  /// a query box centred on a point from the same distribution
+  BoundingBox NextBox(double size)
+  {
+    return {Next(), {BOUNDARY.HalfDimension.X * size, BOUNDARY.HalfDimension.Y * size}};
+  }
+
+  Rng& Random() {return rng;}
+
+private:
+  Point uniformPoint(Rng& r)
+  {
+    const double x = BOUNDARY.Center.X - BOUNDARY.HalfDimension.X + unit(r) * 2.0 * BOUNDARY.HalfDimension.X;
+    const double y = BOUNDARY.Center.Y - BOUNDARY.HalfDimension.Y + unit(r) * 2.0 * BOUNDARY.HalfDimension.Y;
+    return Point(x, y);
+  }
+
+  Rng rng;
+  string kind;
+  std::uniform_real_distribution<double> unit;
+  vector<Point> centers;
+  vector<double> cdf;
+};
+
+struct Percentiles
+{
+  size_t Count = 0;
+  uint64_t P50 = 0;
+  uint64_t P99 = 0;
+  uint64_t P999 = 0;
+};
+
+/// @param ns latencies in nanoseconds. Reordered.
+Percentiles percentiles(vector<uint64_t>& ns)
+{
+  Percentiles r;
+  r.Count = ns.size();
+  if(ns.empty())
+    return r;
+  const auto at = [&ns] (double q) {
+    const size_t i = std::min(ns.size() - 1, static_cast<size_t>(q * ns.size()));
+    std::nth_element(ns.begin(), ns.begin() + i, ns.end());
+    return ns[i];
+  };
+  r.P50 = at(0.50);
+  r.P99 = at(0.99);
+  r.P999 = at(0.999);
+  return r;
+}
+
+struct Result
+{
+  string Tree;
+  string Distribution;
+  unsigned int Threads;
+  string Kernel;
+  double Seconds;
+  Percentiles Insert;
+  Percentiles Query;
+  Percentiles Delete;
+  double QueryPoints; ///< average points returned per query
+  size_t Nodes;       ///< in the tree once the run is over
+  size_t Depth;
+};
+
+/// counts the nodes under node, and the depth of the deepest leaf, node being at depth
+template <typename Node>
+void shape(Node* node, size_t depth, size_t& nodes, size_t& deepest)
+{
+  ++nodes;
+  deepest = std::max(deepest, depth);
+  Node* children[] = {node->nw(), node->ne(), node->sw(), node->se()};
+  for(Node* child : children)
+  {
+    if(child != nullptr)
+      shape(child, depth + 1, nodes, deepest);
+  }
+}
+
+/// The k nearest to p found the way callers did before Nearest():
+/// query a box around p, doubling it until it holds k points and the k'th is no farther than its half-width.
+/// @param found scratch, left holding the nearest, nearest first
+/// @return the number found
+template <typename Tree>
+size_t growNearest(Tree& q, const Point& p, size_t k, double half, vector<Point>& found)
+{
+  const auto closer = [&p] (const Point& a, const Point& b) {
+    return (a.X - p.X) * (a.X - p.X) + (a.Y - p.Y) * (a.Y - p.Y) < (b.X - p.X) * (b.X - p.X) + (b.Y - p.Y) * (b.Y - p.Y);
+  };
+  while(true)
+  {
+    const BoundingBox b = {p, {half, half}};
+    found.clear();
+    q.Query(b, found);
+    const bool everything = b.Contains(q.Boundary());
+    if(found.size() >= k)
+    {
+      std::nth_element(found.begin(), found.begin() + (k - 1), found.end(), closer);
+      const Point& kth = found[k - 1];
+      if(everything || std::hypot(kth.X - p.X, kth.Y - p.Y) <= half)
+      {
+        found.erase(found.begin() + k, found.end());
+        std::sort(found.begin(), found.end(), closer);
+        return found.size();
+      }
+    }
+    else if(everything)
+    {
+      std::sort(found.begin(), found.end(), closer);
+      return found.size();
+    }
+    half *= 2.0;
+  }
+}
+
+/// runs one timed query of the configured kind against q, a live tree or a snapshot
+/// @return the points it found
+template <typename Tree>
+size_t query(Tree& q, const BoundingBox& b, const Config& c, vector<Point>& found)
+{
+  if(c.Query == "count")
+    return q.Count(b);
+  if(c.Query == "nearest")
+    return q.Nearest(b.Center, c.K).size();
+  if(c.Query == "grow")
+    return growNearest(q, b.Center, c.K, b.HalfDimension.X, found);
+  q.Query(b, found);
+  return found.size();
+}
+
+unique_ptr<Quadtree> makeTree(const string& tree, const Config& c)
+{
+  if(tree == "lockfree" || tree == "frozen")
+    return unique_ptr<Quadtree>(new LockfreeQuadtree(BOUNDARY, c.Capacity, c.Alloc, c.Reclaim));
+  if(tree == "lock")
+    return unique_ptr<Quadtree>(new LockQuadtree(BOUNDARY, c.Capacity));
+  if(tree == "sharded")
+    return unique_ptr<Quadtree>(new ShardedQuadtree(BOUNDARY, c.Capacity, c.ShardColumns, c.ShardRows, c.Alloc, c.Reclaim));
+  cerr << "unknown tree " << tree << endl;
+  std::exit(1);
+}
+
+/// fills q with c.Prefill points, using all the threads
+void prefill(Quadtree* q, const Config& c, const string& distribution, unsigned int threads)
+{
+  vector<thread> workers;
+  for(unsigned int t = 0; t != threads; ++t)
+  {
+    workers.push_back(thread([=] () {
+      PointGenerator gen(distribution, c.Seed * 1000003 + t);
+      for(size_t i = t; i < c.Prefill; i += threads)
+        q->Insert(gen.Next());
+    }));
+  }
+  for(auto& w : workers)
+    w.join();
+}
+
+Result runMixed(const string& tree, const string& distribution, unsigned int threads, const Config& c)
+{
+  unique_ptr<Quadtree> q = makeTree(tree, c);
+  prefill(q.get(), c, distribution, threads);
+  // a frozen tree is the lock-free one after prefill, read-only: its share of inserts is skipped
+  unique_ptr<Snapshot> frozen;
+  if(tree == "frozen")
+    frozen = static_cast<LockfreeQuadtree*>(q.get())->Freeze();
+  // the prefill is the load a sharded tree rebalances for
+  if(tree == "sharded" && c.Rebalance)
+    static_cast<ShardedQuadtree*>(q.get())->Rebalance();
+
+  vector<vector<uint64_t>> insertNs(threads);
+  vector<vector<uint64_t>> queryNs(threads);
+  vector<vector<uint64_t>> deleteNs(threads);
+  vector<size_t> queryPoints(threads);
+  vector<thread> workers;
+
+  const steady_clock::time_point start = steady_clock::now();
+  for(unsigned int t = 0; t != threads; ++t)
+  {
+    workers.push_back(thread([&, t] () {
+      PointGenerator gen(distribution, c.Seed * 7919 + t + 1);
+      std::uniform_real_distribution<double> coin(0.0, 1.0);
+      vector<Point> found;
+      vector<uint64_t>& ins = insertNs[t];
+      vector<uint64_t>& qs = queryNs[t];
+      vector<uint64_t>& ds = deleteNs[t];
+      // each thread keeps its share of the window, so deletes never race for the same point
+      std::deque<Point> window;
+      const size_t windowSize = c.Window / threads;
+      const size_t ops = c.Ops / threads;
+      ins.reserve(static_cast<size_t>(ops * c.InsertRatio) + 16);
+      qs.reserve(static_cast<size_t>(ops * (1.0 - c.InsertRatio)) + 16);
+      for(size_t i = 0; i != ops; ++i)
+      {
+        if(coin(gen.Random()) < c.InsertRatio)
+        {
+          if(frozen)
+          {
+            gen.Next();
+            continue;
+          }
+          const Point p = gen.Next();
+          const steady_clock::time_point s = steady_clock::now();
+          q->Insert(p);
+          ins.push_back(duration_cast<nanoseconds>(steady_clock::now() - s).count());
+          if(c.Window != 0)
+          {
+            window.push_back(p);
+            if(window.size() > windowSize)
+            {
+              const steady_clock::time_point d = steady_clock::now();
+              q->Delete(window.front());
+              ds.push_back(duration_cast<nanoseconds>(steady_clock::now() - d).count());
+              window.pop_front();
+            }
+          }
+        }
+        else
+        {
+          const BoundingBox b = gen.NextBox(c.QuerySize);
+          found.clear();
+          size_t n;
+          const steady_clock::time_point s = steady_clock::now();
+          if(frozen)
+            n = query(*frozen, b, c, found);
+          else
+            n = query(*q, b, c, found);
+          qs.push_back(duration_cast<nanoseconds>(steady_clock::now() - s).count());
+          queryPoints[t] += n;
+        }
+      }
+    }));
+  }
+  for(auto& w : workers)
+    w.join();
+  const double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+
+  vector<uint64_t> allInserts;
+  vector<uint64_t> allQueries;
+  vector<uint64_t> allDeletes;
+  size_t points = 0;
+  for(unsigned int t = 0; t != threads; ++t)
+  {
+    allInserts.insert(allInserts.end(), insertNs[t].begin(), insertNs[t].end());
+    allQueries.insert(allQueries.end(), queryNs[t].begin(), queryNs[t].end());
+    allDeletes.insert(allDeletes.end(), deleteNs[t].begin(), deleteNs[t].end());
+    points += queryPoints[t];
+  }
+
+  Result r;
+  r.Tree = tree;
+  r.Distribution = distribution;
+  r.Threads = threads;
+  r.Kernel = quadtree::filter::Name(quadtree::filter::Selected());
+  r.Seconds = seconds;
+  r.Insert = percentiles(allInserts);
+  r.Query = percentiles(allQueries);
+  r.Delete = percentiles(allDeletes);
+  r.QueryPoints = r.Query.Count == 0 ? 0.0 : static_cast<double>(points) / r.Query.Count;
+  r.Nodes = 0;
+  r.Depth = 0;
+  if(frozen)
+    r.Nodes = frozen->Nodes();
+  else if(tree == "lockfree")
+    shape(static_cast<LockfreeQuadtree*>(q.get()), 0, r.Nodes, r.Depth);
+  else if(tree == "sharded")
+  {
+    ShardedQuadtree* sharded = static_cast<ShardedQuadtree*>(q.get());
+    for(size_t i = 0; i != sharded->Shards(); ++i)
+      shape(sharded->shard(i), 1, r.Nodes, r.Depth);
+  }
+  else
+    shape(static_cast<LockQuadtree*>(q.get()), 0, r.Nodes, r.Depth);
+  return r;
+}
+
+void printCsvHeader()
+{
+  cout << "tree,distribution,threads,kernel,capacity,insert_ratio,query_size,ops,seconds,ops_per_sec,"
+       << "inserts,insert_p50_ns,insert_p99_ns,insert_p999_ns,"
+       << "queries,query_p50_ns,query_p99_ns,query_p999_ns,query_points_avg,"
+       << "deletes,delete_p50_ns,delete_p99_ns,delete_p999_ns,nodes,depth" << endl;
+}
+
+void printCsv(const Result& r, const Config& c)
+{
+  const size_t ops = r.Insert.Count + r.Query.Count + r.Delete.Count;
+  cout << r.Tree << "," << r.Distribution << "," << r.Threads << "," << r.Kernel << "," << c.Capacity << ","
+       << c.InsertRatio << "," << c.QuerySize << "," << ops << "," << r.Seconds << "," << ops / r.Seconds << ","
+       << r.Insert.Count << "," << r.Insert.P50 << "," << r.Insert.P99 << "," << r.Insert.P999 << ","
+       << r.Query.Count << "," << r.Query.P50 << "," << r.Query.P99 << "," << r.Query.P999 << ","
+       << r.QueryPoints << ","
+       << r.Delete.Count << "," << r.Delete.P50 << "," << r.Delete.P99 << "," << r.Delete.P999 << ","
+       << r.Nodes << "," << r.Depth << endl;
+}
+
+void printJson(const Result& r, const Config& c, bool first)
+{
+  const size_t ops = r.Insert.Count + r.Query.Count + r.Delete.Count;
+  cout << (first ? "  " : ",\n  ")
+       << "{\"tree\":\"" << r.Tree << "\",\"distribution\":\"" << r.Distribution << "\",\"threads\":" << r.Threads << ",\"kernel\":\"" << r.Kernel << "\""
+       << ",\"capacity\":" << c.Capacity << ",\"insert_ratio\":" << c.InsertRatio << ",\"query_size\":" << c.QuerySize
+       << ",\"ops\":" << ops << ",\"seconds\":" << r.Seconds << ",\"ops_per_sec\":" << ops / r.Seconds
+       << ",\"insert\":{\"count\":" << r.Insert.Count << ",\"p50_ns\":" << r.Insert.P50 << ",\"p99_ns\":" << r.Insert.P99 << ",\"p999_ns\":" << r.Insert.P999 << "}"
+       << ",\"query\":{\"count\":" << r.Query.Count << ",\"p50_ns\":" << r.Query.P50 << ",\"p99_ns\":" << r.Query.P99 << ",\"p999_ns\":" << r.Query.P999
+       << ",\"points_avg\":" << r.QueryPoints << "}"
+       << ",\"delete\":{\"count\":" << r.Delete.Count << ",\"p50_ns\":" << r.Delete.P50 << ",\"p99_ns\":" << r.Delete.P99 << ",\"p999_ns\":" << r.Delete.P999 << "}"
+       << ",\"nodes\":" << r.Nodes << ",\"depth\":" << r.Depth << "}";
+}
+
+vector<string> split(const string& s)
+{
+  vector<string> parts;
+  std::stringstream ss(s);
+  string part;
+  while(std::getline(ss, part, ','))
+  {
+    if(!part.empty())
+      parts.push_back(part);
+  }
+  return parts;
+}
+
+/// @return false if name isn't a kernel
+bool kernelNamed(const string& name, Kernel& k)
+{
+  for(const Kernel candidate : {Kernel::Scalar, Kernel::Sse2, Kernel::Avx2})
+  {
+    if(name == quadtree::filter::Name(candidate))
+    {
+      k = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+void usage()
+{
+  cout << "Usage: bench [--option=value ...]\n"
+       << "  --trees=lockfree,lock      or frozen: the lock-free tree frozen into a Snapshot after prefill; queries only\n"
+       << "                             or sharded: a grid of lock-free trees\n"
+       << "  --distributions=uniform,clusters,zipf,duplicates\n"
+       << "  --threads=1,2,4,8          thread counts to sweep\n"
+       << "  --kernels=auto             leaf filtering kernels to sweep: auto,scalar,sse2,avx2\n"
+       << "  --capacity=4\n"
+       << "  --prefill=1000000          points inserted before timing\n"
+       << "  --ops=1000000              timed operations across all threads\n"
+       << "  --insert-ratio=0.9         the rest are queries\n"
+       << "  --query-size=0.01          query half-size, as a fraction of the boundary\n"
+       << "  --query=points|count|nearest|grow\n"
+       << "                             collect the points in the box, count them, or find the k nearest its centre:\n"
+       << "                             with Nearest, or by growing a box from query-size until it holds them\n"
+       << "  --k=8                      points a nearest or grow query finds\n"
+       << "  --window=0                 if set, a sliding window: each insert deletes the point inserted this many before it\n"
+       << "  --allocation=heap|pool     lock-free tree only\n"
+       << "  --reclamation=hazard|epoch lock-free tree only\n"
+       << "  --shards=4x4               columns x rows, sharded tree only\n"
+       << "  --rebalance=0              1 to rebalance the sharded tree's cells for the prefill's load before timing\n"
+       << "  --format=csv|json\n"
+       << "  --seed=1\n";
+}
+
+/// @return false if the arguments were bad
+bool parse(int argc, char** argv, Config& c)
+{
+  for(int i = 1; i < argc; ++i)
+  {
+    const string arg = argv[i];
+    const size_t eq = arg.find('=');
+    if(arg.compare(0, 2, "--") != 0 || eq == string::npos)
+      return false;
+    const string key = arg.substr(2, eq - 2);
+    const string val = arg.substr(eq + 1);
+    if(key == "trees")
+      c.Trees = split(val);
+    else if(key == "distributions")
+      c.Distributions = split(val);
+    else if(key == "threads")
+    {
+      c.Threads.clear();
+      for(const string& t : split(val))
+        c.Threads.push_back(std::max(1ul, std::strtoul(t.c_str(), 0, 10)));
+    }
+    else if(key == "kernels")
+      c.Kernels = split(val);
+    else if(key == "capacity")
+      c.Capacity = std::strtoul(val.c_str(), 0, 10);
+    else if(key == "prefill")
+      c.Prefill = std::strtoul(val.c_str(), 0, 10);
+    else if(key == "ops")
+      c.Ops = std::strtoul(val.c_str(), 0, 10);
+    else if(key == "insert-ratio")
+      c.InsertRatio = std::strtod(val.c_str(), 0);
+    else if(key == "query-size")
+      c.QuerySize = std::strtod(val.c_str(), 0);
+    else if(key == "query")
+    {
+      if(val != "points" && val != "count" && val != "nearest" && val != "grow")
+        return false;
+      c.Query = val;
+    }
+    else if(key == "window")
+      c.Window = std::strtoul(val.c_str(), 0, 10);
+    else if(key == "k")
+      c.K = std::max(1ul, std::strtoul(val.c_str(), 0, 10));
+    else if(key == "allocation")
+      c.Alloc = val == "pool" ? Allocation::Pool : Allocation::Heap;
+    else if(key == "reclamation")
+      c.Reclaim = val == "epoch" ? Reclamation::Epoch : Reclamation::HazardPointer;
+    else if(key == "shards")
+    {
+      const size_t x = val.find('x');
+      if(x == string::npos)
+        return false;
+      c.ShardColumns = std::max(1ul, std::strtoul(val.substr(0, x).c_str(), 0, 10));
+      c.ShardRows = std::max(1ul, std::strtoul(val.substr(x + 1).c_str(), 0, 10));
+    }
+    else if(key == "rebalance")
+      c.Rebalance = val == "1";
+    else if(key == "format")
+      c.Format = val;
+    else if(key == "seed")
+      c.Seed = std::strtoull(val.c_str(), 0, 10);
+    else
+      return false;
+  }
+  return c.Capacity > 0 && (c.Format == "csv" || c.Format == "json");
+}
+}
+
+int main(int argc, char** argv)
+{
+  Config c;
+  if(!parse(argc, argv, c))
+  {
+    usage();
+    return 1;
+  }
+
+  cout << std::fixed << std::setprecision(3);
+  if(c.Format == "csv")
+    printCsvHeader();
+  else
+    cout << "[\n";
+
+  const Kernel automatic = quadtree::filter::Selected();
+  bool first = true;
+  for(const string& kernel : c.Kernels)
+  {
+    Kernel k = automatic;
+    if(kernel != "auto" && !kernelNamed(kernel, k))
+    {
+      cerr << "unknown kernel " << kernel << endl;
+      return 1;
+    }
+    if(!quadtree::filter::Select(k))
+    {
+      cerr << "this CPU can't run the " << kernel << " kernel, skipping it" << endl;
+      continue;
+    }
+    for(const string& distribution : c.Distributions)
+    {
+      for(const string& tree : c.Trees)
+      {
+        for(const unsigned int threads : c.Threads)
+        {
+          const Result r = runMixed(tree, distribution, threads, c);
+          if(c.Format == "csv")
+            printCsv(r, c);
+          else
+            printJson(r, c, first);
+          first = false;
+        }
+      }
+    }
+  }
+
+  if(c.Format == "json")
+    cout << "\n]" << endl;
+  return 0;
+}
@@ -0,0 +1,381 @@
+#include "filter.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QUADTREE_X86 1
+#include <immintrin.h>
+#else
+#define QUADTREE_X86 0
+#endif
+
+namespace
+{
+using quadtree::BoundingBox;
+using quadtree::filter::Kernel;
+
+typedef size_t (*ContainedFn)(const double*, const double*, size_t, const BoundingBox&, uint32_t*);
+typedef size_t (*ContainedFloatFn)(const float*, const float*, size_t, const BoundingBox&, uint32_t*);
+typedef size_t (*ContainedIntFn)(const int32_t*, const int32_t*, size_t, const BoundingBox&, uint32_t*);
+
+/// The edges of a box, as Coord. Float edges are rounded inward, so a float compares with them as it would with the doubles.
+template <typename Coord>
+struct Edges
+{
+  explicit Edges(const BoundingBox& b)
+    : LoX(atLeast(b.Center.X - b.HalfDimension.X))
+    , HiX(atMost(b.Center.X + b.HalfDimension.X))
+    , LoY(atLeast(b.Center.Y - b.HalfDimension.Y))
+    , HiY(atMost(b.Center.Y + b.HalfDimension.Y))
+  {}
+  /// @return the least Coord no less than v
+  static Coord atLeast(double v)
+  {
+    const Coord c = static_cast<Coord>(v);
+    return c < v ? std::nextafter(c, std::numeric_limits<Coord>::infinity()) : c;
+  }
+  /// @return the greatest Coord no greater than v
+  static Coord atMost(double v)
+  {
+    const Coord c = static_cast<Coord>(v);
+    return c > v ? std::nextafter(c, -std::numeric_limits<Coord>::infinity()) : c;
+  }
+
+  Coord LoX;
+  Coord HiX;
+  Coord LoY;
+  Coord HiY;
+};
+
+/// Integer edges are rounded inward to whole numbers. A box holding no int32_t at all gets edges no integer is between.
+template <>
+struct Edges<int32_t>
+{
+  explicit Edges(const BoundingBox& b)
+  {
+    const double least = std::numeric_limits<int32_t>::min();
+    const double most = std::numeric_limits<int32_t>::max();
+    const double loX = std::ceil(b.Center.X - b.HalfDimension.X);
+    const double hiX = std::floor(b.Center.X + b.HalfDimension.X);
+    const double loY = std::ceil(b.Center.Y - b.HalfDimension.Y);
+    const double hiY = std::floor(b.Center.Y + b.HalfDimension.Y);
+    // written so NaN edges fail it
+    if(!(loX <= hiX && loY <= hiY && loX <= most && hiX >= least && loY <= most && hiY >= least))
+    {
+      LoX = LoY = std::numeric_limits<int32_t>::max();
+      HiX = HiY = std::numeric_limits<int32_t>::min();
+      return;
+    }
+    LoX = static_cast<int32_t>(std::max(loX, least));
+    HiX = static_cast<int32_t>(std::min(hiX, most));
+    LoY = static_cast<int32_t>(std::max(loY, least));
+    HiY = static_cast<int32_t>(std::min(hiY, most));
+  }
+
+  int32_t LoX;
+  int32_t HiX;
+  int32_t LoY;
+  int32_t HiY;
+};
+
+/// indices written from offset base; the vector kernels finish their tails with this
+template <typename Coord>
+inline size_t containedScalar(const Coord* xs, const Coord* ys, size_t n, const BoundingBox& b, uint32_t* out, size_t base)
+{
+  const Edges<Coord> e(b);
+  const Coord loX = e.LoX;
+  const Coord hiX = e.HiX;
+  const Coord loY = e.LoY;
+  const Coord hiY = e.HiY;
+  size_t k = 0;
+  for(size_t i = 0; i != n; ++i)
+  {
+    // the same comparisons as BoundingBox::Contains, so NaNs and edges come out the same
+    if(xs[i] >= loX && xs[i] <= hiX && ys[i] >= loY && ys[i] <= hiY)
+      out[k++] = static_cast<uint32_t>(base + i);
+  }
+  return k;
+}
+
+template <typename Coord>
+size_t scalar(const Coord* xs, const Coord* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  return containedScalar(xs, ys, n, b, out, 0);
+}
+
+#if QUADTREE_X86
+/// for a movemask of up to 4 lanes, the lanes that matched, packed to the front.
+/// A kernel stores the whole row and advances by the popcount, so there's no branch per point.
+alignas(16) const uint32_t COMPRESS[16][4] = {
+  {0, 0, 0, 0}, {0, 0, 0, 0}, {1, 0, 0, 0}, {0, 1, 0, 0},
+  {2, 0, 0, 0}, {0, 2, 0, 0}, {1, 2, 0, 0}, {0, 1, 2, 0},
+  {3, 0, 0, 0}, {0, 3, 0, 0}, {1, 3, 0, 0}, {0, 1, 3, 0},
+  {2, 3, 0, 0}, {0, 2, 3, 0}, {1, 2, 3, 0}, {0, 1, 2, 3},
+};
+const uint8_t POPCOUNT[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+size_t sse2(const double* xs, const double* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  const __m128d loX = _mm_set1_pd(b.Center.X - b.HalfDimension.X);
+  const __m128d hiX = _mm_set1_pd(b.Center.X + b.HalfDimension.X);
+  const __m128d loY = _mm_set1_pd(b.Center.Y - b.HalfDimension.Y);
+  const __m128d hiY = _mm_set1_pd(b.Center.Y + b.HalfDimension.Y);
+  size_t k = 0;
+  size_t i = 0;
+  for(; i + 2 <= n; i += 2)
+  {
+    const __m128d x = _mm_loadu_pd(xs + i);
+    const __m128d y = _mm_loadu_pd(ys + i);
+    const __m128d in = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(x, loX), _mm_cmple_pd(x, hiX)),
+                                  _mm_and_pd(_mm_cmpge_pd(y, loY), _mm_cmple_pd(y, hiY)));
+    const int mask = _mm_movemask_pd(in);
+    const __m128i lanes = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), _mm_load_si128(reinterpret_cast<const __m128i*>(COMPRESS[mask])));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + k), lanes);
+    k += POPCOUNT[mask];
+  }
+  return k + containedScalar(xs + i, ys + i, n - i, b, out + k, i);
+}
+
+__attribute__((target("avx2")))
+size_t avx2(const double* xs, const double* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  const __m256d loX = _mm256_set1_pd(b.Center.X - b.HalfDimension.X);
+  const __m256d hiX = _mm256_set1_pd(b.Center.X + b.HalfDimension.X);
+  const __m256d loY = _mm256_set1_pd(b.Center.Y - b.HalfDimension.Y);
+  const __m256d hiY = _mm256_set1_pd(b.Center.Y + b.HalfDimension.Y);
+  size_t k = 0;
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    const __m256d x = _mm256_loadu_pd(xs + i);
+    const __m256d y = _mm256_loadu_pd(ys + i);
+    const __m256d in = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(x, loX, _CMP_GE_OQ), _mm256_cmp_pd(x, hiX, _CMP_LE_OQ)),
+                                     _mm256_and_pd(_mm256_cmp_pd(y, loY, _CMP_GE_OQ), _mm256_cmp_pd(y, hiY, _CMP_LE_OQ)));
+    const int mask = _mm256_movemask_pd(in);
+    const __m128i lanes = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), _mm_load_si128(reinterpret_cast<const __m128i*>(COMPRESS[mask])));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), lanes);
+    k += POPCOUNT[mask];
+  }
+  return k + containedScalar(xs + i, ys + i, n - i, b, out + k, i);
+}
+
+size_t sse2Float(const float* xs, const float* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  const Edges<float> e(b);
+  const __m128 loX = _mm_set1_ps(e.LoX);
+  const __m128 hiX = _mm_set1_ps(e.HiX);
+  const __m128 loY = _mm_set1_ps(e.LoY);
+  const __m128 hiY = _mm_set1_ps(e.HiY);
+  size_t k = 0;
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    const __m128 x = _mm_loadu_ps(xs + i);
+    const __m128 y = _mm_loadu_ps(ys + i);
+    const __m128 in = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, loX), _mm_cmple_ps(x, hiX)),
+                                 _mm_and_ps(_mm_cmpge_ps(y, loY), _mm_cmple_ps(y, hiY)));
+    const int mask = _mm_movemask_ps(in);
+    const __m128i lanes = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), _mm_load_si128(reinterpret_cast<const __m128i*>(COMPRESS[mask])));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), lanes);
+    k += POPCOUNT[mask];
+  }
+  return k + containedScalar(xs + i, ys + i, n - i, b, out + k, i);
+}
+
+/// 8 points per compare, packed a half at a time
+__attribute__((target("avx2")))
+size_t avx2Float(const float* xs, const float* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  const Edges<float> e(b);
+  const __m256 loX = _mm256_set1_ps(e.LoX);
+  const __m256 hiX = _mm256_set1_ps(e.HiX);
+  const __m256 loY = _mm256_set1_ps(e.LoY);
+  const __m256 hiY = _mm256_set1_ps(e.HiY);
+  size_t k = 0;
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    const __m256 x = _mm256_loadu_ps(xs + i);
+    const __m256 y = _mm256_loadu_ps(ys + i);
+    const __m256 in = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, loX, _CMP_GE_OQ), _mm256_cmp_ps(x, hiX, _CMP_LE_OQ)),
+                                    _mm256_and_ps(_mm256_cmp_ps(y, loY, _CMP_GE_OQ), _mm256_cmp_ps(y, hiY, _CMP_LE_OQ)));
+    const int mask = _mm256_movemask_ps(in);
+    const __m128i low = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), _mm_load_si128(reinterpret_cast<const __m128i*>(COMPRESS[mask & 15])));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), low);
+    k += POPCOUNT[mask & 15];
+    const __m128i high = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i + 4)), _mm_load_si128(reinterpret_cast<const __m128i*>(COMPRESS[mask >> 4])));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), high);
+    k += POPCOUNT[mask >> 4];
+  }
+  return k + containedScalar(xs + i, ys + i, n - i, b, out + k, i);
+}
+
+/// integers have only a greater-than, so this finds the points outside and keeps the rest
+size_t sse2Int(const int32_t* xs, const int32_t* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  const Edges<int32_t> e(b);
+  const __m128i loX = _mm_set1_epi32(e.LoX);
+  const __m128i hiX = _mm_set1_epi32(e.HiX);
+  const __m128i loY = _mm_set1_epi32(e.LoY);
+  const __m128i hiY = _mm_set1_epi32(e.HiY);
+  size_t k = 0;
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(xs + i));
+    const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ys + i));
+    const __m128i outside = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(loX, x), _mm_cmpgt_epi32(x, hiX)),
+                                      _mm_or_si128(_mm_cmpgt_epi32(loY, y), _mm_cmpgt_epi32(y, hiY)));
+    const int mask = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 15;
+    const __m128i lanes = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), _mm_load_si128(reinterpret_cast<const __m128i*>(COMPRESS[mask])));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), lanes);
+    k += POPCOUNT[mask];
+  }
+  return k + containedScalar(xs + i, ys + i, n - i, b, out + k, i);
+}
+
+__attribute__((target("avx2")))
+size_t avx2Int(const int32_t* xs, const int32_t* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  const Edges<int32_t> e(b);
+  const __m256i loX = _mm256_set1_epi32(e.LoX);
+  const __m256i hiX = _mm256_set1_epi32(e.HiX);
+  const __m256i loY = _mm256_set1_epi32(e.LoY);
+  const __m256i hiY = _mm256_set1_epi32(e.HiY);
+  size_t k = 0;
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + i));
+    const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys + i));
+    const __m256i outside = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(loX, x), _mm256_cmpgt_epi32(x, hiX)),
+                                            _mm256_or_si256(_mm256_cmpgt_epi32(loY, y), _mm256_cmpgt_epi32(y, hiY)));
+    const int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 255;
+    const __m128i low = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), _mm_load_si128(reinterpret_cast<const __m128i*>(COMPRESS[mask & 15])));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), low);
+    k += POPCOUNT[mask & 15];
+    const __m128i high = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i + 4)), _mm_load_si128(reinterpret_cast<const __m128i*>(COMPRESS[mask >> 4])));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), high);
+    k += POPCOUNT[mask >> 4];
+  }
+  return k + containedScalar(xs + i, ys + i, n - i, b, out + k, i);
+}
+#endif
+
+ContainedFn kernelFn(Kernel k)
+{
+#if QUADTREE_X86
+  if(k == Kernel::Avx2)
+    return avx2;
+  if(k == Kernel::Sse2)
+    return sse2;
+#endif
+  return scalar<double>;
+}
+
+ContainedFloatFn floatKernelFn(Kernel k)
+{
+#if QUADTREE_X86
+  if(k == Kernel::Avx2)
+    return avx2Float;
+  if(k == Kernel::Sse2)
+    return sse2Float;
+#endif
+  return scalar<float>;
+}
+
+ContainedIntFn intKernelFn(Kernel k)
+{
+#if QUADTREE_X86
+  if(k == Kernel::Avx2)
+    return avx2Int;
+  if(k == Kernel::Sse2)
+    return sse2Int;
+#endif
+  return scalar<int32_t>;
+}
+
+Kernel best()
+{
+  if(quadtree::filter::Supported(Kernel::Avx2))
+    return Kernel::Avx2;
+  if(quadtree::filter::Supported(Kernel::Sse2))
+    return Kernel::Sse2;
+  return Kernel::Scalar;
+}
+
+// scalar until the initializer below runs, for anything that queries from another file's static initializer
+Kernel selected = Kernel::Scalar;
+ContainedFn contained = scalar<double>;
+ContainedFloatFn containedFloat = scalar<float>;
+ContainedIntFn containedInt = scalar<int32_t>;
+const bool initialized = quadtree::filter::Select(best());
+}
+
+namespace quadtree
+{
+namespace filter
+{
+size_t Contained(const double* xs, const double* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  return contained(xs, ys, n, b, out);
+}
+
+size_t Contained(const float* xs, const float* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  return containedFloat(xs, ys, n, b, out);
+}
+
+size_t Contained(const int32_t* xs, const int32_t* ys, size_t n, const BoundingBox& b, uint32_t* out)
+{
+  return containedInt(xs, ys, n, b, out);
+}
+
+bool Supported(Kernel k)
+{
+  switch(k)
+  {
+  case Kernel::Scalar:
+    return true;
+#if QUADTREE_X86
+  case Kernel::Sse2:
+    return __builtin_cpu_supports("sse2");
+  case Kernel::Avx2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+bool Select(Kernel k)
+{
+  if(!Supported(k))
+    return false;
+  selected = k;
+  contained = kernelFn(k);
+  containedFloat = floatKernelFn(k);
+  containedInt = intKernelFn(k);
+  return true;
+}
+
+Kernel Selected()
+{
+  return selected;
+}
+
+const char* Name(Kernel k)
+{
+  switch(k)
+  {
+  case Kernel::Sse2:
+    return "sse2";
+  case Kernel::Avx2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+}
+}
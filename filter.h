@@ -0,0 +1,107 @@
+#ifndef filterH
+#define filterH
+
+#include <cstddef>
+#include <cstdint>
+#include "quadtree.h"
+
+namespace quadtree
+{
+/// Containment tests over points stored as separate X and Y arrays, several points per instruction where the CPU can.
+/// The kernel is picked once, at startup, from what the CPU supports; Select() overrides it, for benchmarking.
+namespace filter
+{
+enum class Kernel
+{
+  Scalar,
+  Sse2, ///< 2 points per compare
+  Avx2  ///< 4 points per compare
+};
+
+/// how many indices past the last match a vector kernel may write
+const size_t SLACK = 8;
+/// points ForEachContained() tests per call to the kernel
+const size_t BLOCK = 256;
+
+/// writes the index of each i < n where b.Contains(Point(xs[i], ys[i])) to out, in increasing order
+/// @param out room for n + SLACK indices
+/// @return the number of indices written
+size_t Contained(const double* xs, const double* ys, size_t n, const BoundingBox& b, uint32_t* out);
+/// the same for float coordinates, twice as many points per compare. Each is compared with b as a double would be.
+size_t Contained(const float* xs, const float* ys, size_t n, const BoundingBox& b, uint32_t* out);
+/// the same for integer coordinates, as many points per compare as float
+size_t Contained(const int32_t* xs, const int32_t* ys, size_t n, const BoundingBox& b, uint32_t* out);
+
+bool        Supported(Kernel k);
+/// Not safe to call while anything is querying.
+/// @return false, changing nothing, if this CPU can't run k
+bool        Select(Kernel k);
+Kernel      Selected();
+const char* Name(Kernel k);
+
+/// calls emit with each point i of [xs, ys) inside b for which keep(i) holds, in order, with its ID from ids.
+/// An emit that only wants the IDs never reads the coordinates of the points it's given, once inlined.
+/// @param leaf a box containing every point. If b contains all of it, nothing is tested.
+template <typename Coord, typename Keep, typename Emit>
+void ForEachContained(const Coord* xs, const Coord* ys, const uint64_t* ids, size_t n, const BoundingBox& b, const BoundingBox& leaf, const Keep& keep, Emit& emit)
+{
+  if(b.Contains(leaf))
+  {
+    for(size_t i = 0; i != n; ++i)
+    {
+      if(keep(i))
+        emit(Point(xs[i], ys[i], ids[i]));
+    }
+    return;
+  }
+  uint32_t matches[BLOCK + SLACK];
+  for(size_t begin = 0; begin < n; begin += BLOCK)
+  {
+    const size_t count = n - begin < BLOCK ? n - begin : BLOCK;
+    const size_t found = Contained(xs + begin, ys + begin, count, b, matches);
+    for(size_t i = 0; i != found; ++i)
+    {
+      const size_t j = begin + matches[i];
+      if(keep(j))
+        emit(Point(xs[j], ys[j], ids[j]));
+    }
+  }
+}
+
+/// calls emit with each point of [xs, ys) inside b, in order
+template <typename Coord, typename Emit>
+void ForEachContained(const Coord* xs, const Coord* ys, const uint64_t* ids, size_t n, const BoundingBox& b, const BoundingBox& leaf, Emit& emit)
+{
+  ForEachContained(xs, ys, ids, n, b, leaf, [] (size_t) {return true;}, emit);
+}
+
+/// ForEachContained for any region with a box around it, a circle or a convex polygon: the box is filtered as above, and
+/// only the points inside it are tested against the region itself.
+/// @param leaf a box containing every point. If region contains all of it, nothing is tested.
+template <typename Region, typename Coord, typename Keep, typename Emit>
+void ForEachInside(const Coord* xs, const Coord* ys, const uint64_t* ids, size_t n, const Region& region, const BoundingBox& leaf, const Keep& keep, Emit& emit)
+{
+  if(region.Contains(leaf))
+  {
+    ForEachContained(xs, ys, ids, n, leaf, leaf, keep, emit);
+    return;
+  }
+  const auto inside = [&] (size_t i) {return keep(i) && region.Contains(Point(xs[i], ys[i]));};
+  ForEachContained(xs, ys, ids, n, region.Bounds(), leaf, inside, emit);
+}
+
+/// a box is its own box, so it's only filtered once
+template <typename Coord, typename Keep, typename Emit>
+void ForEachInside(const Coord* xs, const Coord* ys, const uint64_t* ids, size_t n, const BoundingBox& b, const BoundingBox& leaf, const Keep& keep, Emit& emit)
+{
+  ForEachContained(xs, ys, ids, n, b, leaf, keep, emit);
+}
+
+template <typename Region, typename Coord, typename Emit>
+void ForEachInside(const Coord* xs, const Coord* ys, const uint64_t* ids, size_t n, const Region& region, const BoundingBox& leaf, Emit& emit)
+{
+  ForEachInside(xs, ys, ids, n, region, leaf, [] (size_t) {return true;}, emit);
+}
+}
+}
+#endif // filterH
@@ -2,9 +2,17 @@
 #include <vector>
 #include "quadtree.h"
 #include "free_quadtree.h"
+#include "stats.h"
+#include "filter.h"
 #include <atomic>
 #include <memory>
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <iterator>
+#include <type_traits>
+#include <cassert>
 
 namespace
 {
@@ -13,367 +21,1658 @@ using std::cout;
 using std::endl;
 using std::atomic;
 
-/// Each thread has lists of pointers to delete.
-/// These are compared to the non-thread-local hazard pointer list.
-/// If no hazard pointer contains the pointer, it is safe for deletion.
-thread_local std::vector<quadtree::PointList*> deleteList;
-thread_local std::vector<quadtree::PointList*> deleteWithNodeList;
+using quadtree::Allocation;
+using quadtree::BoundingBox;
+
+/// Deleter for a bucket whose points have all moved elsewhere
+template <typename Bucket>
+void freeBucket(void* p, Allocation a)
+{
+  Bucket::Destroy(a, static_cast<Bucket*>(p));
+}
+
+/// Deleter for a node a merge has folded into its parent
+template <typename Tree>
+void freeNode(void* p, Allocation a)
+{
+  quadtree::Destroy(a, static_cast<Tree*>(p));
+}
+
+/// what a query appends for each point it finds: the point, or just its ID
+inline void append(vector<quadtree::Point>& found, const quadtree::Point& p)
+{
+  found.push_back(p);
+}
+inline void append(vector<uint64_t>& found, const quadtree::Point& p)
+{
+  found.push_back(p.ID);
+}
+
+/// calls emit with each point of the bucket chain inside r, a box or another query region, that hasn't been deleted.
+/// Moved points are still emitted: until the move finishes they aren't anywhere else a reader would look.
+template <typename Bucket, typename Region, typename Emit>
+void forEachPoint(Bucket* bucket, const Region& r, const BoundingBox& leaf, Emit& emit)
+{
+  for(; bucket != nullptr; bucket = bucket->Overflow.load())
+  {
+    const size_t n = bucket->Published.load();
+    if(bucket->Dead.load() == 0)
+      quadtree::filter::ForEachInside(bucket->Xs(), bucket->Ys(), bucket->IDs(), n, r, leaf, emit);
+    else
+    {
+      const std::atomic<uint8_t>* states = bucket->States();
+      const auto live = [states] (size_t i) {return states[i].load() != Bucket::DEAD;};
+      quadtree::filter::ForEachInside(bucket->Xs(), bucket->Ys(), bucket->IDs(), n, r, leaf, live, emit);
+    }
+  }
+}
+
+/// waits for another thread that's partway through a short step
+inline void pause()
+{
+  std::this_thread::yield();
+}
+
+/// scratch space for the visiting Query
+thread_local std::vector<quadtree::Point> queryBuffer;
+/// The inserts this thread has buffered, for each tree it buffers them for.
+/// Trees are told apart by a generation that's never reused, not by address: a tree made where a destroyed one was mustn't
+/// get its points. A tree's destructor drops the destroying thread's entry; others' are dropped the next time they look up
+/// a tree at the same address, or, once emptied by a flush, any other tree.
+/// There's no flush when the thread exits: the trees, and the per-thread state inserting needs, may be gone by then.
+class PendingInserts
+{
+public:
+  vector<quadtree::Point>& For(const void* tree, uint64_t generation)
+  {
+    trees.erase(std::remove_if(trees.begin(), trees.end(), [tree, generation] (const Entry& e)
+                               {return e.Generation != generation && (e.Tree == tree || e.Points.empty());}),
+                trees.end());
+    vector<quadtree::Point>* points = Find(generation);
+    if(points != nullptr)
+      return *points;
+    trees.push_back({tree, generation, vector<quadtree::Point>()});
+    return trees.back().Points;
+  }
+  /// @return the tree's buffer, or nullptr if this thread has none for it
+  vector<quadtree::Point>* Find(uint64_t generation)
+  {
+    for(Entry& e : trees)
+    {
+      if(e.Generation == generation)
+        return &e.Points;
+    }
+    return nullptr;
+  }
+  void Drop(uint64_t generation)
+  {
+    trees.erase(std::remove_if(trees.begin(), trees.end(), [generation] (const Entry& e) {return e.Generation == generation;}),
+                trees.end());
+  }
+private:
+  struct Entry
+  {
+    const void* Tree;
+    uint64_t Generation;
+    vector<quadtree::Point> Points;
+  };
+  vector<Entry> trees;
+};
+/// the generation BufferInserts() gives the next tree to buffer
+std::atomic<uint64_t> nextGeneration(1);
+thread_local PendingInserts pendingInserts;
+/// a leaf's points, held back until the scan is known not to have raced a subdivision
+thread_local std::vector<quadtree::Point> nearestBuffer;
 }
 
 namespace quadtree
 {
-std::atomic<LockfreeQuadtree::HazardPointer*> LockfreeQuadtree::HazardPointer::head;
+template <typename Coord, size_t FixedCapacity>
+BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::Bucket(size_t capacity)
+  : Capacity(capacity)
+  , Reserved(0)
+  , Published(0)
+  , Dispersed(0)
+  , Moved(0)
+  , Dead(0)
+  , Overflow(nullptr)
+  , Target(nullptr)
+{
+  std::atomic<uint8_t>* states = States();
+  for(size_t i = 0; i != capacity; ++i)
+    new (states + i) std::atomic<uint8_t>(LIVE);
+}
+
+/// rounded up to a whole number of cache lines, so pooled buckets stay aligned
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::bytes(size_t capacity)
+{
+  return (sizeof(Bucket) + capacity * (2 * sizeof(Coord) + sizeof(uint64_t) + 1) + alignof(Bucket) - 1) / alignof(Bucket) * alignof(Bucket);
+}
+
+template <typename Coord, size_t FixedCapacity>
+typename BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket* BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::Make(Allocation a, size_t capacity)
+{
+  void* memory = a == Allocation::Heap ? ::operator new(bytes(capacity), std::align_val_t(alignof(Bucket))) : pool::Allocate(bytes(capacity));
+  return new (memory) Bucket(capacity);
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::Destroy(Allocation a, Bucket* b)
+{
+  const size_t size = bytes(b->Capacity);
+  Destination* target = b->Target.load();
+  if(target != nullptr && target != &frozen)
+    quadtree::Destroy(a, target);
+  b->~Bucket();
+  if(a == Allocation::Heap)
+    ::operator delete(b, std::align_val_t(alignof(Bucket)));
+  else
+    pool::Free(b, size);
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::Add(const Point* points, size_t n)
+{
+  const size_t i = Reserved.fetch_add(n);
+  if(i >= Capacity)
+    return 0;
+  const size_t added = std::min(n, Capacity - i);
+  for(size_t j = 0; j != added; ++j)
+  {
+    Xs()[i + j] = static_cast<Coord>(points[j].X);
+    Ys()[i + j] = static_cast<Coord>(points[j].Y);
+    IDs()[i + j] = points[j].ID;
+  }
+  while(Published.load() != i)
+    pause();
+  Published.store(i + added);
+  return added;
+}
+
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::Add(const Point& p)
+{
+  const size_t i = Reserved.fetch_add(1);
+  if(i >= Capacity)
+    return false;
+  Xs()[i] = static_cast<Coord>(p.X);
+  Ys()[i] = static_cast<Coord>(p.Y);
+  IDs()[i] = p.ID;
+  // publish in order. Whoever claimed the slot before ours is a store away from publishing it.
+  while(Published.load() != i)
+    pause();
+  Published.store(i + 1);
+  return true;
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::WaitFull()
+{
+  while(Published.load() < Capacity)
+    pause();
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::Seal()
+{
+  const size_t n = std::min(Reserved.fetch_add(Capacity), Capacity);
+  while(Published.load() < n)
+    pause();
+  return n;
+}
+
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::Remove(const Point& p)
+{
+  const Coord* xs = Xs();
+  const Coord* ys = Ys();
+  const uint64_t* ids = IDs();
+  std::atomic<uint8_t>* states = States();
+  for(size_t i = 0, n = Published.load(); i != n; ++i)
+  {
+    uint8_t live = LIVE;
+    if(xs[i] == p.X && ys[i] == p.Y && ids[i] == p.ID && states[i].compare_exchange_strong(live, DEAD))
+    {
+      Dead.fetch_add(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket::Remove(const BoundingBox& b)
+{
+  const Coord* xs = Xs();
+  const Coord* ys = Ys();
+  std::atomic<uint8_t>* states = States();
+  size_t removed = 0;
+  for(size_t i = 0, n = Published.load(); i != n; ++i)
+  {
+    uint8_t live = LIVE;
+    if(b.Contains(Point(xs[i], ys[i])) && states[i].compare_exchange_strong(live, DEAD))
+      ++removed;
+  }
+  Dead.fetch_add(removed);
+  return removed;
+}
 
-LockfreeQuadtree::LockfreeQuadtree(BoundingBox boundary_, size_t capacity_)
-  : boundary(boundary_)
-  , points(new PointList(capacity_))
+template <typename Coord, size_t FixedCapacity>
+BasicLockfreeQuadtree<Coord, FixedCapacity>::BasicLockfreeQuadtree(BoundingBox boundary_, size_t capacity_, Allocation allocation_, Reclamation reclamation_)
+  : boundary(std::is_integral<Coord>::value ? IntegerBoundary(boundary_) : boundary_)
+  , allocation(allocation_)
+  , reclamation(reclamation_)
+  , capacity(FixedCapacity != 0 ? FixedCapacity : capacity_)
+  , points(Bucket::Make(allocation_, capacity))
   , Nw(nullptr)
   , Ne(nullptr)
   , Sw(nullptr)
   , Se(nullptr)
+  , count(0)
+  , moving(0)
+  , state(LEAF)
+  , unbounded(std::is_integral<Coord>::value && IntegerLevels(boundary) == 0)
+  , levels(std::is_integral<Coord>::value ? IntegerLevels(boundary) : 0)
+  , combine(0)
+  , generation(0)
+  , visibility(Buffered::ReadYourWrites)
+  , consistency(Consistency::Restarting)
+{}
+
+template <typename Coord, size_t FixedCapacity>
+BasicLockfreeQuadtree<Coord, FixedCapacity>::~BasicLockfreeQuadtree()
 {
-  subdividing.store(false);
+  if(generation != 0)
+    pendingInserts.Drop(generation);
+  for(Bucket* b = points.load(); b != nullptr;)
+  {
+    Bucket* next = b->Overflow.load();
+    Bucket::Destroy(allocation, b);
+    b = next;
+  }
+  BasicLockfreeQuadtree* children[] = {Nw.load(), Ne.load(), Sw.load(), Se.load()};
+  for(BasicLockfreeQuadtree* child : children)
+  {
+    if(child != nullptr)
+      Destroy(allocation, child);
+  }
 }
-/*
-/// @todo finish this
-bool LockfreeQuadtree::Delete(const Point& p)
+
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockfreeQuadtree<Coord, FixedCapacity>::Insert(const Point& given)
 {
-  if(!boundary.Contains(p))
-    return false;
-  HazardPointer* hazardPointer = HazardPointer::Acquire(); // @todo create a finaliser/whileinscope class for HazardPointers.
-  while(true)
+  const Point p = stored(given);
+  if(combine != 0)
   {
-    while(hazardPointer->Hazard.load() != points.load())
-      hazardPointer->Hazard.store(points.load());
-    PointList* oldPoints = hazardPointer->Hazard.load();
-    if(oldPoints == nullptr || oldPoints->Length >= oldPoints->Capacity)
-      break;
+    if(!boundary.Contains(p))
+      return false;
+    vector<Point>& pending = pendingInserts.For(this, generation);
+    pending.push_back(p);
+    if(pending.size() >= combine)
+      Flush();
+    return true;
+  }
+  Guard pin(Reclamation::Epoch); // keeps nodes a merge removes alive, whatever reclaims the buckets
+  return insert(p) == Outcome::Done;
+}
 
-    PointListNode* node = oldPoints->First;
-    while(node != nullptr)
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::BufferInserts(size_t batch, Buffered visibility_)
+{
+  if(batch == 0)
+    Flush();
+  else if(generation == 0)
+    generation = nextGeneration.fetch_add(1);
+  combine = batch;
+  visibility = visibility_;
+}
+
+/// Works with buffering off too, so a thread can still flush what it buffered before it was turned off.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::Flush()
+{
+  if(generation == 0)
+    return;
+  vector<Point>* pending = pendingInserts.Find(generation);
+  if(pending == nullptr || pending->empty())
+    return;
+  InsertBatch(*pending);
+  pending->clear();
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::ownWrites()
+{
+  if(combine != 0 && visibility == Buffered::ReadYourWrites)
+    Flush();
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::InsertBatch(vector<Point>& ps)
+{
+  if(!std::is_same<Coord, double>::value)
+    std::transform(ps.begin(), ps.end(), ps.begin(), stored);
+  Guard pin(Reclamation::Epoch);
+  const auto inside = std::partition(ps.begin(), ps.end(), [this] (const Point& p) {return boundary.Contains(p);});
+  Point* begin = ps.data();
+  Point* end = begin + (inside - ps.begin());
+  // nothing merges the root away, but a merge of its own children can hold a batch up like anything else
+  while(begin != end)
+    begin += insertBatch(begin, end);
+  return inside - ps.begin();
+}
+
+/// Like insert, but each leaf takes as many as it has room for at once, and each node adds them to its count at once.
+/// An internal node groups the points by the child insert would put them in.
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::insertBatch(Point* begin, Point* end)
+{
+  Point* next = begin;
+  while(next != end)
+  {
+    const uint64_t s = state.load();
+    if(kind(s) == MERGING)
     {
-      if(node->NodePoint == p)
+      pause();
+      continue;
+    }
+    if(kind(s) == LEAF && unbounded)
+    {
+      // chained buckets take them one at a time
+      for(; next != end; ++next)
       {
-	const bool ok = points.compare_exchange_strong(node->Next, newPoints);	
+        if(insert(*next) != Outcome::Done)
+          return next - begin;
       }
+      return next - begin;
+    }
+    if(kind(s) == LEAF)
+    {
+      size_t added;
+      bool isFrozen;
+      {
+        Guard guard(reclamation);
+        Bucket* bucket = guard.Protect(points);
+        if(bucket == nullptr)
+          continue; // split since we read the state
+        added = bucket->Add(next, end - next);
+        isFrozen = bucket->Target.load() == &frozen;
+      }
+      if(added != 0)
+      {
+        count.fetch_add(added);
+        next += added;
+        continue;
+      }
+      if(isFrozen)
+        return next - begin;
+      subdivide();
+      continue;
     }
 
-    PointList* newPoints = new PointList(oldPoints->Capacity);
-    newPoints->First = new PointListNode(p, oldPoints->First);
-    newPoints->Length = oldPoints->Length + 1;
-    const bool ok = points.compare_exchange_strong(oldPoints, newPoints);
-    hazardPointer->Hazard.store(nullptr);
-
-    if(ok)
+    BasicLockfreeQuadtree* children[4];
+    bool merged = false;
+    for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
     {
-      deleteList.push_back(oldPoints);
-      gc();
-      HazardPointer::Release(hazardPointer); /// @todo create a finaliser. This is dangerous. I don't like it. Not one bit.
-      return true;
+      children[quadrant] = child(quadrant).load();
+      merged = merged || children[quadrant] == nullptr;
     }
-    else
+    if(merged)
+      continue;
+    Point* groups[5] = {next, nullptr, nullptr, nullptr, end};
+    for(unsigned int quadrant = 0; quadrant != 3; ++quadrant)
     {
-      delete newPoints->First;
-      delete newPoints;
+      groups[quadrant + 1] = std::partition(groups[quadrant], end, [this, &children, quadrant] (const Point& p) {
+        return quadrantOf(children, p) == quadrant;
+      });
     }
+    for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+    {
+      if(groups[quadrant] == groups[quadrant + 1])
+        continue;
+      const size_t done = children[quadrant]->insertBatch(groups[quadrant], groups[quadrant + 1]);
+      count.fetch_add(done);
+      next = groups[quadrant] + done;
+      if(next != groups[quadrant + 1])
+        break; // frozen by a merge. Wait for it, and put the rest in whatever's here then.
+    }
+  }
+  return next - begin;
+}
 
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockfreeQuadtree<Coord, FixedCapacity>::Delete(const Point& p)
+{
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  return erase(stored(p)) == Outcome::Done;
+}
 
-  }
-  HazardPointer::Release(hazardPointer);
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::Delete(const BoundingBox& b)
+{
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  return erase(b);
+}
+
+template <typename Coord, size_t FixedCapacity>
+typename BasicLockfreeQuadtree<Coord, FixedCapacity>::Outcome BasicLockfreeQuadtree<Coord, FixedCapacity>::insert(const Point& p)
+{
+  if(!boundary.Contains(p))
+    return Outcome::Outside;
+  while(true)
+  {
+    const uint64_t s = state.load();
+    if(kind(s) == MERGING)
+    {
+      pause();
+      continue;
+    }
+    if(kind(s) == LEAF)
+    {
+      {
+        Guard guard(reclamation);
+        Bucket* bucket = guard.Protect(points);
+        if(bucket == nullptr)
+          continue; // split since we read the state
+        // a full bucket stays full, so there's nothing to retry
+        if(bucket->Add(p))
+        {
+          count.fetch_add(1);
+          return Outcome::Done;
+        }
 
-  if(points.load() != nullptr)
-    subdivide();
+        // at the precision limit buckets chain rather than subdivide, and are never retired
+        while(bucket != nullptr && unbounded)
+        {
+          Bucket* next = bucket->Overflow.load();
+          if(next == nullptr)
+          {
+            Bucket* fresh = Bucket::Make(allocation, bucket->Capacity * 2);
+            if(bucket->Overflow.compare_exchange_strong(next, fresh))
+              next = fresh;
+            else
+            {
+              QUADTREE_COUNT(InsertCasFailures);
+              Bucket::Destroy(allocation, fresh);
+            }
+          }
+          bucket = next;
+          if(bucket->Add(p))
+          {
+            count.fetch_add(1);
+            return Outcome::Done;
+          }
+        }
+        if(bucket != nullptr && bucket->Target.load() == &frozen)
+          return Outcome::Retry;
+      }
+      subdivide();
+      continue;
+    }
 
-  return Nw.load()->Delete(p) || Ne.load()->Delete(p) || Sw.load()->Delete(p) || Se.load()->Delete(p);
+    Outcome o = Outcome::Outside;
+    if(std::is_integral<Coord>::value)
+    {
+      // exactly one child holds each integer point, and its bits say which
+      BasicLockfreeQuadtree* c = child(IntegerQuadrant(p, boundary, levels)).load();
+      o = c == nullptr ? Outcome::Retry : c->insert(p);
+    }
+    else
+    {
+      for(unsigned int quadrant = 0; quadrant != 4 && o == Outcome::Outside; ++quadrant)
+      {
+        BasicLockfreeQuadtree* c = child(quadrant).load();
+        o = c == nullptr ? Outcome::Retry : c->insert(p); // a null child was merged away since we read the state
+      }
+    }
+    if(o == Outcome::Done)
+    {
+      count.fetch_add(1);
+      return Outcome::Done;
+    }
+    if(o == Outcome::Outside)
+      return Outcome::Outside;
+  }
 }
-*/
-bool LockfreeQuadtree::Insert(const Point& p)
+
+/// Points equal to p on a shared edge may be in any child whose boundary contains it, so each is tried.
+/// A point that isn't found while the node changed is looked for again, in case it moved out from under the scan.
+template <typename Coord, size_t FixedCapacity>
+typename BasicLockfreeQuadtree<Coord, FixedCapacity>::Outcome BasicLockfreeQuadtree<Coord, FixedCapacity>::erase(const Point& p)
 {
   if(!boundary.Contains(p))
-    return false;
-  HazardPointer* hazardPointer = HazardPointer::Acquire(); // @todo create a finaliser/whileinscope class for HazardPointers.
+    return Outcome::Outside;
   while(true)
   {
-    while(hazardPointer->Hazard.load() != points.load())
-      hazardPointer->Hazard.store(points.load());
-    PointList* oldPoints = hazardPointer->Hazard.load();
-    if(oldPoints == nullptr || oldPoints->Length >= oldPoints->Capacity)
-      break;
-    PointList* newPoints = new PointList(oldPoints->Capacity);
-    newPoints->First = new PointListNode(p, oldPoints->First);
-    newPoints->Length = oldPoints->Length + 1;
-    const bool ok = points.compare_exchange_strong(oldPoints, newPoints);
-    hazardPointer->Hazard.store(nullptr);
-
-    if(ok)
-    {
-      deleteList.push_back(oldPoints);
-      gc();
-      HazardPointer::Release(hazardPointer); /// @todo create a finaliser. This is dangerous. I don't like it. Not one bit.
-      return true;
+    const uint64_t s = state.load();
+    if(kind(s) == MERGING)
+    {
+      pause();
+      continue;
+    }
+    if(kind(s) == LEAF)
+    {
+      Destination* target;
+      {
+        Guard guard(reclamation);
+        Bucket* bucket = guard.Protect(points);
+        if(bucket == nullptr)
+          continue;
+        target = bucket->Target.load();
+        for(Bucket* b = bucket; b != nullptr; b = b->Overflow.load())
+        {
+          if(b->Remove(p))
+          {
+            count.fetch_sub(1);
+            return Outcome::Done;
+          }
+        }
+      }
+      if(target == &frozen)
+        return Outcome::Retry;
+      if(target != nullptr)
+      {
+        // some points have moved out of the scan's sight. Finish the move and look where they went.
+        subdivide();
+        continue;
+      }
+      if(state.load() != s)
+        continue;
+      return Outcome::Outside;
+    }
+
+    Outcome o = Outcome::Outside;
+    if(std::is_integral<Coord>::value)
+    {
+      BasicLockfreeQuadtree* c = child(IntegerQuadrant(p, boundary, levels)).load();
+      o = c == nullptr ? Outcome::Retry : c->erase(p);
     }
     else
     {
-      delete newPoints->First;
-      delete newPoints;
+      for(unsigned int quadrant = 0; quadrant != 4 && o == Outcome::Outside; ++quadrant)
+      {
+        BasicLockfreeQuadtree* c = child(quadrant).load();
+        o = c == nullptr ? Outcome::Retry : c->erase(p);
+      }
+    }
+    if(o == Outcome::Done)
+    {
+      count.fetch_sub(1);
+      merge();
+      return Outcome::Done;
     }
+    if(o == Outcome::Outside && state.load() == s)
+      return Outcome::Outside;
   }
-  HazardPointer::Release(hazardPointer);
+}
+
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockfreeQuadtree<Coord, FixedCapacity>::Move(const Point& from, const Point& to)
+{
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  const Point f = stored(from);
+  const Point t = stored(Point(to.X, to.Y, from.ID));
+  if(!boundary.Contains(f) || !boundary.Contains(t))
+    return false;
+  // nothing merges the root away, so it never has to go again
+  return move(nullptr, f, t) == Outcome::Done;
+}
 
-  PointList* localPoints = points.load(); // we don't need to set the Hazard Pointer because we never dereference the pointer
-  if(localPoints != nullptr)
-    subdivide();
+/// Walks down while one child holds both points, to the lowest node that does, and moves the point with erase and insert
+/// there. Readers of this subtree wait for moving to say it's finished, and read the subtree again if they raced it.
+/// A parent can't merge a node away while a move is under way in it: the move says so before it looks for a merge,
+/// and a merge looks for moves after it says it's merging, so one of them sees the other and gives way.
+/// Merges of this node's own children still go ahead, and erase and insert wait for them as they always do.
+template <typename Coord, size_t FixedCapacity>
+typename BasicLockfreeQuadtree<Coord, FixedCapacity>::Outcome BasicLockfreeQuadtree<Coord, FixedCapacity>::move(BasicLockfreeQuadtree* parent, const Point& from, const Point& to)
+{
+  while(true)
+  {
+    const uint64_t s = state.load();
+    if(kind(s) == MERGING)
+    {
+      pause();
+      continue;
+    }
+    if(kind(s) == INTERNAL)
+    {
+      BasicLockfreeQuadtree* children[4];
+      bool merged = false;
+      for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      {
+        children[quadrant] = child(quadrant).load();
+        merged = merged || children[quadrant] == nullptr;
+      }
+      if(merged)
+        continue;
+      // from may be in any child whose boundary holds it, so this only goes down if just one does
+      const unsigned int quadrant = quadrantOf(children, to);
+      bool alone = true;
+      if(!std::is_integral<Coord>::value)
+      {
+        for(unsigned int other = 0; other != 4; ++other)
+          alone = alone && (other == quadrant) == children[other]->boundary.Contains(from);
+      }
+      else
+        alone = IntegerQuadrant(from, boundary, levels) == quadrant;
+      if(alone)
+      {
+        const Outcome o = children[quadrant]->move(this, from, to);
+        if(o != Outcome::Retry)
+          return o;
+        continue; // merged away. Whatever's here now takes it.
+      }
+    }
 
-  // these will each need Hazard Pointers if it's ever possible for a subtree to be deleted
-  return Nw.load()->Insert(p) || Ne.load()->Insert(p) || Sw.load()->Insert(p) || Se.load()->Insert(p);
+    moving.fetch_add(1);
+    if(parent != nullptr && kind(parent->state.load()) == MERGING)
+    {
+      moving.fetch_sub(1);
+      return Outcome::Retry;
+    }
+    Outcome o = erase(from);
+    if(o == Outcome::Done)
+    {
+      // no merge can freeze this node now, so there's always room for it
+      o = insert(to);
+      // if to has nowhere to go after all, from goes back, so the point is never lost
+      if(o != Outcome::Done)
+      {
+        const Outcome restored = insert(from);
+        assert(restored == Outcome::Done);
+        (void)restored;
+      }
+      // either way the point was taken out and put in again, which a reader partway through has to see
+      moving.fetch_add(MOVE_FINISHED - 1);
+    }
+    else
+      moving.fetch_sub(1);
+    return o;
+  }
 }
 
-void LockfreeQuadtree::subdivide()
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::erase(const BoundingBox& b)
 {
-  subdividing.store(true);
-  HazardPointer* hazardPointer = HazardPointer::Acquire(); // @todo pass this rather than expensively reacquiring
-  while(hazardPointer->Hazard.load() != points.load())
-    hazardPointer->Hazard.store(points.load());
-  PointList* oldPoints = hazardPointer->Hazard.load();
-  if(oldPoints == nullptr)
+  if(!boundary.Intersects(b))
+    return 0;
+  size_t removed = 0;
+  while(true)
   {
-    return;
+    const uint64_t s = state.load();
+    if(kind(s) == MERGING)
+    {
+      pause();
+      continue;
+    }
+    size_t n = 0;
+    if(kind(s) == LEAF)
+    {
+      bool moving;
+      {
+        Guard guard(reclamation);
+        Bucket* bucket = guard.Protect(points);
+        if(bucket == nullptr)
+          continue;
+        const Destination* target = bucket->Target.load();
+        moving = target != nullptr && target != &frozen;
+        for(Bucket* c = bucket; c != nullptr; c = c->Overflow.load())
+          n += c->Remove(b);
+      }
+      count.fetch_sub(n);
+      removed += n;
+      if(moving)
+      {
+        subdivide();
+        continue;
+      }
+    }
+    else
+    {
+      for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      {
+        BasicLockfreeQuadtree* c = child(quadrant).load();
+        if(c != nullptr)
+          n += c->erase(b);
+      }
+      count.fetch_sub(n);
+      removed += n;
+      if(n != 0)
+        merge();
+    }
+    // a frozen leaf's parent is merging, so the parent sees its own state change and goes again
+    if(state.load() == s)
+      return removed;
   }
+}
+
+template <typename Coord, size_t FixedCapacity>
+std::atomic<BasicLockfreeQuadtree<Coord, FixedCapacity>*>& BasicLockfreeQuadtree<Coord, FixedCapacity>::child(unsigned int quadrant)
+{
+  switch(quadrant)
+  {
+  case 0: return Nw;
+  case 1: return Ne;
+  case 2: return Sw;
+  default: return Se;
+  }
+}
+
+/// The first thread to find the bucket full decides where its points go: into four new children, or,
+/// if at least half of them have been deleted, into a fresh bucket for this same leaf.
+/// It builds the whole destination before anyone else can see it, with buckets sized to fit and every live point already
+/// copied in, and publishes it with one CAS of Target. After that, helping is a state change per slot and no allocation.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::subdivide()
+{
+  Guard guard(reclamation); // @todo pass this rather than expensively reacquiring
+  Bucket* old = guard.Protect(points);
+  if(old == nullptr || unbounded)
+    return;
+  Destination* target = old->Target.load();
+  if(target == nullptr)
+  {
+    if(old->Reserved.load() < old->Capacity)
+      return; // already replaced by a compacted bucket
+    // once every claimed slot is written the points don't change, only their states
+    old->WaitFull();
+    target = Make<Destination>(allocation);
+    const bool compact = old->Dead.load() * 2 >= old->Capacity;
+    Bucket* into[4] = {nullptr, nullptr, nullptr, nullptr};
+    if(compact)
+    {
+      std::fill(target->Children, target->Children + 4, nullptr);
+      target->Compacted = Bucket::Make(allocation, old->Capacity);
+      into[0] = target->Compacted;
+    }
+    else
+    {
+      // don't subdivide further if we reach the limits of precision
+      const bool atLimit = atPrecisionLimit();
+      for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      {
+        target->Children[quadrant] = Make<BasicLockfreeQuadtree>(allocation, boundary.Quadrant(quadrant), capacity, allocation, reclamation);
+        target->Children[quadrant]->unbounded = atLimit;
+      }
+      target->Compacted = nullptr;
+      // a merged bucket may hold more than capacity, and they may all be in one quadrant
+      size_t sizes[4] = {0, 0, 0, 0};
+      for(size_t i = 0; i != old->Capacity; ++i)
+        ++sizes[quadrantOf(target->Children, Point(old->Xs()[i], old->Ys()[i]))];
+      for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      {
+        BasicLockfreeQuadtree* c = target->Children[quadrant];
+        if(sizes[quadrant] > capacity)
+        {
+          Bucket::Destroy(allocation, c->points.load());
+          c->points.store(Bucket::Make(allocation, sizes[quadrant]));
+        }
+        into[quadrant] = c->points.load();
+      }
+    }
 
-  size_t capacity = oldPoints->Capacity;
+    target->Slots.assign(old->Capacity, static_cast<uint32_t>(Destination::NOWHERE));
+    const std::atomic<uint8_t>* states = old->States();
+    for(size_t i = 0; i != old->Capacity; ++i)
+    {
+      if(states[i].load() == Bucket::DEAD)
+        continue;
+      const Point p(old->Xs()[i], old->Ys()[i], old->IDs()[i]);
+      const unsigned int quadrant = compact ? 0 : quadrantOf(target->Children, p);
+      Bucket* b = into[quadrant];
+      const size_t slot = b->Published.load();
+      b->Xs()[slot] = static_cast<Coord>(p.X);
+      b->Ys()[slot] = static_cast<Coord>(p.Y);
+      b->IDs()[slot] = p.ID;
+      b->Published.store(slot + 1);
+      target->Slots[i] = static_cast<uint32_t>(quadrant << Destination::SLOT_BITS | slot);
+    }
+    for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+    {
+      if(into[quadrant] == nullptr)
+        continue;
+      into[quadrant]->Reserved.store(into[quadrant]->Published.load());
+      if(!compact)
+        target->Children[quadrant]->count.store(into[quadrant]->Published.load());
+    }
 
-  HazardPointer::Release(hazardPointer);
+    Destination* expected = nullptr;
+    if(old->Target.compare_exchange_strong(expected, target))
+    {
+      if(compact)
+        QUADTREE_COUNT(Compactions);
+      else
+        QUADTREE_COUNT(SubdivisionsStarted);
+    }
+    else
+    {
+      if(compact)
+        Bucket::Destroy(allocation, target->Compacted);
+      for(BasicLockfreeQuadtree* c : target->Children)
+      {
+        if(c != nullptr)
+          Destroy(allocation, c);
+      }
+      Destroy(allocation, target);
+      target = expected;
+    }
+  }
+  else
+    QUADTREE_COUNT(SubdivisionsHelped);
 
+  if(target != &frozen) // a merge takes frozen points itself
+    disperse(old, target);
+}
 
-  if(capacity == 0) // if cap=0 someone beat us here. Skip to dispersing.
+/// The quadrant insert() would put p in: for integers, the one its bits pick; otherwise the first child whose boundary
+/// contains it. The quadrants cover their parent, so whatever isn't in the first three is in the last.
+template <typename Coord, size_t FixedCapacity>
+unsigned int BasicLockfreeQuadtree<Coord, FixedCapacity>::quadrantOf(BasicLockfreeQuadtree* const* children, const Point& p) const
+{
+  if(std::is_integral<Coord>::value)
+    return IntegerQuadrant(p, boundary, levels);
+  for(unsigned int quadrant = 0; quadrant != 3; ++quadrant)
   {
-    disperse();
-    return;
+    if(children[quadrant]->boundary.Contains(p))
+      return quadrant;
   }
+  return 3;
+}
 
+/// Below about a millionth of a unit a double leaf stops splitting. An integer leaf stops exactly where it holds one coordinate.
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockfreeQuadtree<Coord, FixedCapacity>::atPrecisionLimit() const
+{
+  if(std::is_integral<Coord>::value)
+    return levels == 1;
   const double dx = 0.000001;
-  // don't subdivide further if we reach the limits of double precision
-  if(fabs(boundary.HalfDimension.X/2.0) < dx || fabs(boundary.HalfDimension.Y/2.0) < dx)
-    capacity = std::numeric_limits<size_t>::max();
+  return fabs(boundary.HalfDimension.X/2.0) < dx || fabs(boundary.HalfDimension.Y/2.0) < dx;
+}
 
-  const Point newHalf = {boundary.HalfDimension.X / 2.0, boundary.HalfDimension.Y / 2.0}; 
-  LockfreeQuadtree* lval = nullptr;
+/// Marks each slot of the full bucket moved. Any number of threads can help; each slot is claimed by one.
+/// A slot is moved by CAS from live, so a concurrent delete either gets there first or finds it gone.
+/// If the delete got there first, the copy is deleted here too, before the copy can be seen.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::disperse(Bucket* old, Destination* target)
+{
+  std::atomic<uint8_t>* states = old->States();
+  const size_t n = old->Capacity;
+  for(size_t i = old->Dispersed.fetch_add(1); i < n; i = old->Dispersed.fetch_add(1))
+  {
+    const uint32_t where = target->Slots[i];
+    uint8_t live = Bucket::LIVE;
+    if(where != Destination::NOWHERE)
+    {
+      if(states[i].compare_exchange_strong(live, Bucket::MOVED))
+        QUADTREE_COUNT(DisperseMoves);
+      else
+      {
+        BasicLockfreeQuadtree* c = target->Compacted == nullptr ? target->Children[where >> Destination::SLOT_BITS] : nullptr;
+        Bucket* b = c == nullptr ? target->Compacted : c->points.load();
+        b->States()[where & ((1u << Destination::SLOT_BITS) - 1)].store(Bucket::DEAD);
+        b->Dead.fetch_add(1);
+        // the delete took it off this node's count, and the new child's count still has it
+        if(c != nullptr)
+          c->count.fetch_sub(1);
+      }
+    }
+    if(old->Moved.fetch_add(1) + 1 == n)
+      finish(old, target);
+  }
+  // every slot is claimed; whoever holds the last ones is a few stores from finishing
+  if(old->Moved.load() < n)
+    pause();
+}
 
-  Point newCenter = {boundary.Center.X - boundary.HalfDimension.X/2.0, boundary.Center.Y - boundary.HalfDimension.Y/2.0};
-  BoundingBox newBoundary = {newCenter, newHalf};
-  LockfreeQuadtree* q = new LockfreeQuadtree(newBoundary, capacity);
-  const bool nwOk = Nw.compare_exchange_strong(lval, q);
-  if(!nwOk)
+/// Run once, by whoever moved the last slot: puts the target in the old bucket's place.
+/// The new points or children are in place before the state changes, and the state changes before the old bucket goes,
+/// so a reader that sees either the old state or the old bucket can tell it has to look again.
+/// A leaf whose points are null is mid-split; readers just load the state again.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::finish(Bucket* old, Destination* target)
+{
+  if(target->Compacted != nullptr)
+  {
+    points.store(target->Compacted);
+    state.store(advance(state.load(), LEAF));
+  }
+  else
   {
-    delete q;
-    while(Nw.load() == nullptr);
+    for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      child(quadrant).store(target->Children[quadrant]);
+    // before the state changes, so a merge, which waits for INTERNAL, can't have put a bucket here first
+    points.store(nullptr);
+    state.store(advance(state.load(), INTERNAL));
   }
+  Retire(reclamation, old, freeBucket<Bucket>, allocation);
+}
 
-  newCenter = {boundary.Center.X + boundary.HalfDimension.X/2.0, boundary.Center.Y - boundary.HalfDimension.Y/2.0};
-  newBoundary = {newCenter, newHalf};
-  q = new LockfreeQuadtree(newBoundary, capacity);
-  const bool neOk = Ne.compare_exchange_strong(lval, q);
-  if(!neOk)
+/// Whoever moves the node to MERGING does the whole merge, and anything else reaching the node waits for it.
+/// Each child's bucket is frozen first, by CAS of its Target, so it can't start splitting or compacting;
+/// if one already has, the merge backs out. Then the buckets are sealed and their live points copied up.
+/// The children are retired by epoch, since readers may still be inside them without a hazard pointer.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::merge()
+{
+  if(count.load() > capacity / 2)
+    return;
+  uint64_t s = state.load();
+  if(kind(s) != INTERNAL)
+    return;
+  BasicLockfreeQuadtree* children[4];
+  for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
   {
-    delete q;
-    while(Ne.load() == nullptr);
+    children[quadrant] = child(quadrant).load();
+    if(children[quadrant] == nullptr || children[quadrant]->unbounded || kind(children[quadrant]->state.load()) != LEAF)
+      return;
+  }
+  if(!state.compare_exchange_strong(s, advance(s, MERGING)))
+    return;
+  // a move in a child would lose its point if the child were frozen under it
+  for(BasicLockfreeQuadtree* c : children)
+  {
+    if(underway(c->moving.load()))
+    {
+      state.store(advance(state.load(), INTERNAL));
+      return;
+    }
   }
 
-  newCenter = {boundary.Center.X + boundary.HalfDimension.X/2.0, boundary.Center.Y + boundary.HalfDimension.Y/2.0};
-  newBoundary = {newCenter, newHalf};
-  q = new LockfreeQuadtree(newBoundary, capacity);
-  const bool seOk = Se.compare_exchange_strong(lval, q);
-  if(!seOk)
+  Bucket* buckets[4];
+  unsigned int frozenCount = 0;
   {
-    delete q;
-    while(Se.load() == nullptr);
+    Guard guard(reclamation);
+    for(; frozenCount != 4; ++frozenCount)
+    {
+      // once frozen, a bucket is only freed with its node
+      Bucket* b = guard.Protect(children[frozenCount]->points);
+      Destination* expected = nullptr;
+      if(b == nullptr || !b->Target.compare_exchange_strong(expected, &frozen))
+        break;
+      buckets[frozenCount] = b;
+    }
+  }
+  if(frozenCount != 4)
+  {
+    for(unsigned int i = 0; i != frozenCount; ++i)
+      buckets[i]->Target.store(nullptr);
+    state.store(advance(state.load(), INTERNAL));
+    return;
   }
 
-  newCenter = {boundary.Center.X - boundary.HalfDimension.X/2.0, boundary.Center.Y + boundary.HalfDimension.Y/2.0};
-  newBoundary = {newCenter, newHalf};
-  q = new LockfreeQuadtree(newBoundary, capacity);
-  const bool swOk = Sw.compare_exchange_strong(lval, q);
-  if(!swOk)
+  size_t written[4];
+  size_t live = 0;
+  for(unsigned int i = 0; i != 4; ++i)
+  {
+    written[i] = buckets[i]->Seal();
+    const std::atomic<uint8_t>* states = buckets[i]->States();
+    for(size_t j = 0; j != written[i]; ++j)
+      live += states[j].load() == Bucket::LIVE;
+  }
+  // deletes may still land while this copies, but nothing is added; live can only shrink
+  Bucket* merged = Bucket::Make(allocation, std::max(capacity, live));
+  size_t k = 0;
+  for(unsigned int i = 0; i != 4; ++i)
   {
-    delete q;
-    while(Sw.load() == nullptr);
+    std::atomic<uint8_t>* states = buckets[i]->States();
+    for(size_t j = 0; j != written[i]; ++j)
+    {
+      uint8_t expected = Bucket::LIVE;
+      if(states[j].compare_exchange_strong(expected, Bucket::MOVED))
+      {
+        merged->Xs()[k] = buckets[i]->Xs()[j];
+        merged->Ys()[k] = buckets[i]->Ys()[j];
+        merged->IDs()[k] = buckets[i]->IDs()[j];
+        ++k;
+      }
+    }
   }
+  merged->Reserved.store(k);
+  merged->Published.store(k);
 
-  disperse();
+  points.store(merged);
+  for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+    child(quadrant).store(nullptr);
+  state.store(advance(state.load(), LEAF));
+  for(BasicLockfreeQuadtree* c : children)
+    Retire(Reclamation::Epoch, c, freeNode<BasicLockfreeQuadtree>, allocation);
+  QUADTREE_COUNT(Merges);
 }
 
-void LockfreeQuadtree::disperse()
+template <typename Coord, size_t FixedCapacity>
+std::unique_ptr<BasicLockfreeQuadtree<Coord, FixedCapacity>> BasicLockfreeQuadtree<Coord, FixedCapacity>::BulkLoad(const vector<Point>& points, BoundingBox boundary, size_t capacity,
+                                                                                                                     Allocation allocation, Reclamation reclamation, unsigned int threads)
 {
-  PointList* oldPoints;
-  HazardPointer* hazardPointer = HazardPointer::Acquire(); // @todo pass this rather than expensively reacquiring
-  while(true)
-  {
-    while(hazardPointer->Hazard.load() != points.load())
-      hazardPointer->Hazard.store(points.load());
-    oldPoints = hazardPointer->Hazard.load();
+  if(threads == 0)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  // an integer tree may cover more than boundary, so points are sorted within what it does cover
+  std::unique_ptr<BasicLockfreeQuadtree> q(new BasicLockfreeQuadtree(boundary, capacity, allocation, reclamation));
+  vector<Point> rounded;
+  if(!std::is_same<Coord, double>::value)
+    std::transform(points.begin(), points.end(), std::back_inserter(rounded), stored);
+  const vector<MortonPoint> sorted = MortonSort(std::is_same<Coord, double>::value ? points : rounded, q->boundary, threads);
 
-    if(oldPoints == nullptr || oldPoints->Length == 0)
-      break;
-    
-    PointList* newPoints = new PointList(0); // set the capacity to 0, so no one else tries to add
+  // spawn four ways at each level until there's a subtree per thread
+  unsigned int parallelLevels = 0;
+  for(unsigned int subtrees = 1; subtrees < threads; subtrees *= 4)
+    ++parallelLevels;
 
-    Point p = oldPoints->First->NodePoint;
-    newPoints->First = oldPoints->First->Next;
-    newPoints->Length = oldPoints->Length - 1;
+  vector<Point> misfits;
+  q->build(sorted.data(), sorted.data() + sorted.size(), 0, parallelLevels, misfits);
+  for(const Point& p : misfits)
+    q->Insert(p);
+  return q;
+}
 
-    /// @todo we must atomically swap the new points, and insert the point into the child.
-    ///       we can do this by making Query() help in the dispersal
-    bool ok = points.compare_exchange_strong(oldPoints, newPoints);
-    hazardPointer->Hazard.store(nullptr);
-    if(!ok)
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::build(const MortonPoint* begin, const MortonPoint* end, unsigned int level, unsigned int parallelLevels, vector<Point>& misfits)
+{
+  Bucket* bucket = points.load();
+  const size_t n = end - begin;
+  if(n <= bucket->Capacity || unbounded || level == MORTON_LEVELS)
+  {
+    // anything that doesn't fit goes back through Insert, which chains or subdivides as usual
+    Coord* xs = bucket->Xs();
+    Coord* ys = bucket->Ys();
+    uint64_t* ids = bucket->IDs();
+    size_t k = 0;
+    for(const MortonPoint* m = begin; m != end; ++m)
     {
-      delete newPoints;
-      continue;
+      if(k == bucket->Capacity || !boundary.Contains(m->P))
+        misfits.push_back(m->P);
+      else
+      {
+        xs[k] = static_cast<Coord>(m->P.X);
+        ys[k] = static_cast<Coord>(m->P.Y);
+        ids[k] = m->P.ID;
+        ++k;
+      }
     }
+    bucket->Reserved.store(k);
+    bucket->Published.store(k);
+    count.store(k);
+    return;
+  }
 
-    deleteWithNodeList.push_back(oldPoints);
-    gc();
+  const bool atLimit = atPrecisionLimit();
+  BasicLockfreeQuadtree* children[4];
+  for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+  {
+    children[quadrant] = Make<BasicLockfreeQuadtree>(allocation, boundary.Quadrant(quadrant), capacity, allocation, reclamation);
+    children[quadrant]->unbounded = atLimit;
+  }
 
-    ok = Nw.load()->Insert(p) || Ne.load()->Insert(p) || Sw.load()->Insert(p) || Se.load()->Insert(p);
+  const MortonPoint* ends[4];
+  MortonSplit(begin, end, level, ends);
+  const MortonPoint* begins[4] = {begin, ends[0], ends[1], ends[2]};
+  if(level < parallelLevels)
+  {
+    vector<Point> childMisfits[4];
+    vector<std::thread> workers;
+    for(unsigned int quadrant = 1; quadrant != 4; ++quadrant)
+    {
+      workers.push_back(std::thread([&, quadrant] () {
+        children[quadrant]->build(begins[quadrant], ends[quadrant], level + 1, parallelLevels, childMisfits[quadrant]);
+      }));
+    }
+    children[0]->build(begins[0], ends[0], level + 1, parallelLevels, childMisfits[0]);
+    for(auto& w : workers)
+      w.join();
+    for(const auto& m : childMisfits)
+      misfits.insert(misfits.end(), m.begin(), m.end());
+  }
+  else
+  {
+    for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      children[quadrant]->build(begins[quadrant], ends[quadrant], level + 1, parallelLevels, misfits);
   }
-  HazardPointer::Release(hazardPointer); /// @todo create a finaliser. This is dangerous. I don't like it. Not one bit.
 
-  if(oldPoints != nullptr)
-    points.store(nullptr);
+  size_t total = 0;
+  for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+  {
+    total += children[quadrant]->count.load();
+    child(quadrant).store(children[quadrant]);
+  }
+  count.store(total);
+  points.store(nullptr);
+  state.store(INTERNAL);
+  Bucket::Destroy(allocation, bucket);
 }
 
-vector<Point> LockfreeQuadtree::Query(const BoundingBox& b)
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::Query(const BoundingBox& b, vector<Point>& found)
 {
-  vector<Point> found;
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  if(consistency == Consistency::Bounded)
+    boundedQuery(b, found);
+  else
+    query(b, found);
+}
 
-  if(!boundary.Intersects(b))
-    return found;
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::Query(const Circle& c, vector<Point>& found)
+{
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  if(consistency == Consistency::Bounded)
+    boundedQuery(c, found);
+  else
+    query(c, found);
+}
 
-  HazardPointer* hazardPointer = HazardPointer::Acquire();
-  while(hazardPointer->Hazard.load() != points.load())
-    hazardPointer->Hazard.store(points.load());
-  PointList* localPoints = hazardPointer->Hazard.load();
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::Query(const ConvexPolygon& c, vector<Point>& found)
+{
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  if(consistency == Consistency::Bounded)
+    boundedQuery(c, found);
+  else
+    query(c, found);
+}
 
-  const bool previouslySubdivided = localPoints == nullptr;
-  if(!previouslySubdivided && subdividing.load() == true)
-  {
-    cout << "query helping\n";
-    HazardPointer::Release(hazardPointer);
-    subdivide();
-    return Query(b);
-  }
+/// Query, reading only the IDs out of the leaves
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::QueryIDs(const BoundingBox& b, vector<uint64_t>& found)
+{
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  if(consistency == Consistency::Bounded)
+    boundedQuery(b, found);
+  else
+    query(b, found);
+}
 
-  if(localPoints != nullptr)
+/// A split publishes the children before it clears the bucket, and a merge the bucket before it clears the children,
+/// so one or the other is always there. This only goes round again if the node split or merged between the two loads.
+/// A bucket that's splitting is still current until the split finishes: nothing reaches the children before then, and
+/// its slots that aren't dead are exactly the points it holds. Once finished, it stays as it was at that moment.
+template <typename Coord, size_t FixedCapacity>
+typename BasicLockfreeQuadtree<Coord, FixedCapacity>::Bucket* BasicLockfreeQuadtree<Coord, FixedCapacity>::current(Guard& guard, BasicLockfreeQuadtree* children[4])
+{
+  while(true)
   {
-    for(auto node = localPoints->First; node != nullptr; node = node->Next)
+    Bucket* bucket = guard.Protect(points);
+    if(bucket != nullptr)
+      return bucket;
+    bool all = true;
+    for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
     {
-      if(b.Contains(node->NodePoint))
-	found.push_back(node->NodePoint);
+      children[quadrant] = child(quadrant).load();
+      all = all && children[quadrant] != nullptr;
     }
+    if(all)
+      return nullptr;
   }
-  HazardPointer::Release(hazardPointer);
+}
 
-  LockfreeQuadtree* nw = Nw.load();
-  if(nw != nullptr)
+/// Reads each node once, as current() finds it. A node a merge has removed is still read as it was when it was frozen;
+/// the pinned epoch keeps it alive.
+template <typename Coord, size_t FixedCapacity>
+template <typename Region, typename Found>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::boundedQuery(const Region& r, vector<Found>& found)
+{
+  if(!r.Intersects(boundary))
+    return;
+  if(!std::is_same<Region, BoundingBox>::value && r.Contains(boundary))
   {
-    vector<Point> f = nw->Query(b);
-    found.insert(found.end(), f.begin(), f.end());
+    boundedQuery(boundary, found);
+    return;
+  }
+  BasicLockfreeQuadtree* children[4];
+  {
+    Guard guard(reclamation);
+    Bucket* bucket = current(guard, children);
+    if(bucket != nullptr)
+    {
+      const auto emit = [&found] (const Point& p) {append(found, p);};
+      forEachPoint(bucket, r, boundary, emit);
+      return;
+    }
   }
+  for(BasicLockfreeQuadtree* c : children)
+    c->boundedQuery(r, found);
+}
 
-  LockfreeQuadtree* ne = Ne.load();
-  if(ne != nullptr)
+/// If the node changed while we were reading it, redo it. We probably missed some points as they were being moved.
+/// Only this subtree's results are thrown away; everything before start belongs to the caller.
+/// A subtree a circle or polygon wholly contains is read as a query of its own boundary, which tests none of its points.
+/// A box already skips the tests in such a subtree's leaves.
+template <typename Coord, size_t FixedCapacity>
+template <typename Region, typename Found>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::query(const Region& r, vector<Found>& found)
+{
+  if(!r.Intersects(boundary))
+    return;
+  if(!std::is_same<Region, BoundingBox>::value && r.Contains(boundary))
   {
-    vector<Point> f = ne->Query(b);
-    found.insert(found.end(), f.begin(), f.end());
+    query(boundary, found);
+    return;
   }
 
-  LockfreeQuadtree* sw = Sw.load();
-  if(sw != nullptr)
+  const size_t start = found.size();
+  while(true)
   {
-    vector<Point> f = sw->Query(b);
-    found.insert(found.end(), f.begin(), f.end());
+    const uint64_t s = state.load();
+    const uint64_t m = moving.load();
+    if(kind(s) == MERGING || underway(m))
+    {
+      pause();
+      continue;
+    }
+    if(kind(s) == LEAF)
+    {
+      bool help;
+      {
+        Guard guard(reclamation);
+        Bucket* bucket = guard.Protect(points);
+        if(bucket == nullptr)
+          continue;
+        const Destination* target = bucket->Target.load();
+        help = target != nullptr && target != &frozen;
+        const auto emit = [&found] (const Point& p) {append(found, p);};
+        if(!help)
+          forEachPoint(bucket, r, boundary, emit);
+      }
+      if(help)
+      {
+        QUADTREE_COUNT(QueryHelps);
+        subdivide();
+        continue;
+      }
+    }
+    else
+    {
+      for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      {
+        BasicLockfreeQuadtree* c = child(quadrant).load();
+        if(c != nullptr)
+          c->query(r, found);
+      }
+    }
+
+    if(state.load() != s || moving.load() != m)
+    {
+      QUADTREE_COUNT(QueryRestarts);
+      found.erase(found.begin() + start, found.end());
+      continue; // absolutely necessary
+    }
+    return;
   }
-  
-  LockfreeQuadtree* se = Se.load();
-  if(se != nullptr)
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::QueryBatch(const vector<BoundingBox>& boxes, vector<vector<Point>>& found)
+{
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  found.resize(boxes.size());
+  // the active boxes, a stack of one slice per level. Kept per thread so a batch allocates nothing once it has run a few times.
+  thread_local vector<BatchEntry> active;
+  active.clear();
+  for(size_t i = 0; i != boxes.size(); ++i)
   {
-    vector<Point> f = se->Query(b);
-    found.insert(found.end(), f.begin(), f.end());
+    if(boundary.Intersects(boxes[i]))
+      active.push_back({static_cast<uint32_t>(i), found[i].size()});
   }
+  if(!active.empty())
+    queryBatch(boxes, found, active, 0);
+}
 
-  // if the tree subdivided while we were querying, redo the query. We probably missed some points as they were being moved.
-  if(!previouslySubdivided && (subdividing.load() == true || points.load() == nullptr))
+/// query, for every active box at once. A leaf's bucket is protected once and each of its buckets filtered against each box in turn.
+/// A restart throws away what this subtree found for every active box, as query does for one.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::queryBatch(const vector<BoundingBox>& boxes, vector<vector<Point>>& found, vector<BatchEntry>& active, size_t begin)
+{
+  const size_t end = active.size();
+  while(true)
   {
-    cout << "query subdividied\n";
-    return Query(b); // absolutely necessary
+    const uint64_t s = state.load();
+    const uint64_t m = moving.load();
+    if(kind(s) == MERGING || underway(m))
+    {
+      pause();
+      continue;
+    }
+    if(kind(s) == LEAF)
+    {
+      bool help;
+      {
+        Guard guard(reclamation);
+        Bucket* bucket = guard.Protect(points);
+        if(bucket == nullptr)
+          continue;
+        const Destination* target = bucket->Target.load();
+        help = target != nullptr && target != &frozen;
+        for(; !help && bucket != nullptr; bucket = bucket->Overflow.load())
+        {
+          const size_t n = bucket->Published.load();
+          const std::atomic<uint8_t>* states = bucket->States();
+          const bool dead = bucket->Dead.load() != 0;
+          const auto live = [states, dead] (size_t i) {return !dead || states[i].load() != Bucket::DEAD;};
+          for(size_t i = begin; i != end; ++i)
+          {
+            vector<Point>& out = found[active[i].Box];
+            const auto emit = [&out] (const Point& p) {out.push_back(p);};
+            filter::ForEachContained(bucket->Xs(), bucket->Ys(), bucket->IDs(), n, boxes[active[i].Box], boundary, live, emit);
+          }
+        }
+      }
+      if(help)
+      {
+        QUADTREE_COUNT(QueryHelps);
+        subdivide();
+        continue;
+      }
+    }
+    else
+    {
+      for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      {
+        BasicLockfreeQuadtree* c = child(quadrant).load();
+        if(c == nullptr)
+          continue;
+        for(size_t i = begin; i != end; ++i)
+        {
+          const uint32_t box = active[i].Box;
+          if(c->boundary.Intersects(boxes[box]))
+            active.push_back({box, found[box].size()});
+        }
+        if(active.size() != end)
+          c->queryBatch(boxes, found, active, end);
+        active.resize(end);
+      }
+    }
+
+    if(state.load() != s || moving.load() != m)
+    {
+      QUADTREE_COUNT(QueryRestarts);
+      for(size_t i = begin; i != end; ++i)
+      {
+        vector<Point>& out = found[active[i].Box];
+        out.erase(out.begin() + active[i].Start, out.end());
+      }
+      continue;
+    }
+    return;
   }
-  return found;
 }
 
-/// tries to delete everything in this thread's delete lists.
-/// This is part of the hazard pointer implementation
-void LockfreeQuadtree::gc()
+/// The caller's pin lasts the whole Run, so nothing any worker reaches from the tree is freed until it's done.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::ParallelQuery(const BoundingBox& b, vector<Point>& found, TaskPool& pool, size_t grain)
 {
-  if(deleteList.empty() && deleteWithNodeList.empty())
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  vector<vector<Point>> buffers(pool.Size());
+  pool.Run([&] (unsigned int worker) {parallelQuery(b, pool, grain, buffers, worker);});
+  size_t total = found.size();
+  for(const auto& buffer : buffers)
+    total += buffer.size();
+  found.reserve(total);
+  for(const auto& buffer : buffers)
+    found.insert(found.end(), buffer.begin(), buffer.end());
+}
+
+/// Leaves, small subtrees and anything changing underneath us get the ordinary query, which restarts as it must.
+/// An internal node's children are handed out without rechecking the node afterwards. If it merges meanwhile, each child
+/// is frozen with every point it had, so each point is still found exactly once.
+/// Children outside b aren't spawned, and the last one is walked here rather than queued.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::parallelQuery(const BoundingBox& b, TaskPool& pool, size_t grain, vector<vector<Point>>& buffers, unsigned int worker)
+{
+  if(!boundary.Intersects(b))
     return;
 
-  vector<PointList*> hazards;
-  for(HazardPointer* head = HazardPointer::Head(); head != nullptr; head = head->Next) 
+  BasicLockfreeQuadtree* children[4];
+  unsigned int n = 0;
+  bool split = kind(state.load()) == INTERNAL && count.load() > grain;
+  for(unsigned int quadrant = 0; split && quadrant != 4; ++quadrant)
   {
-    PointList* p = head->Hazard.load();
-    if(p != nullptr)
-      hazards.push_back(p);
+    BasicLockfreeQuadtree* c = child(quadrant).load();
+    if(c == nullptr)
+      split = false;
+    else if(c->boundary.Intersects(b))
+      children[n++] = c;
   }
-  std::sort(hazards.begin(), hazards.end(), std::less<PointList*>());
-  for(auto i = deleteList.begin(); i != deleteList.end();)
+  if(!split)
   {
-    if(!std::binary_search(hazards.begin(), hazards.end(), *i))
+    query(b, buffers[worker]);
+    return;
+  }
+
+  for(unsigned int i = 0; i + 1 < n; ++i)
+  {
+    BasicLockfreeQuadtree* c = children[i];
+    pool.Spawn(worker, [c, b, grain, &pool, &buffers] (unsigned int w) {c->parallelQuery(b, pool, grain, buffers, w);});
+  }
+  if(n != 0)
+    children[n - 1]->parallelQuery(b, pool, grain, buffers, worker);
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::Count(const BoundingBox& b)
+{
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  return consistency == Consistency::Bounded ? boundedTally(b) : tally(b);
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::boundedTally(const BoundingBox& b)
+{
+  if(!boundary.Intersects(b))
+    return 0;
+  if(b.Contains(boundary))
+    return count.load();
+  BasicLockfreeQuadtree* children[4];
+  size_t n = 0;
+  {
+    Guard guard(reclamation);
+    Bucket* bucket = current(guard, children);
+    if(bucket != nullptr)
     {
-      delete (*i);
-      i = deleteList.erase(i);
+      const auto tick = [&n] (const Point&) {++n;};
+      forEachPoint(bucket, b, boundary, tick);
+      return n;
     }
-    else
-      ++i;
   }
-  for(auto i = deleteWithNodeList.begin(); i != deleteWithNodeList.end();)
+  for(BasicLockfreeQuadtree* c : children)
+    n += c->boundedTally(b);
+  return n;
+}
+
+/// Walks like query, restarting the same way, but takes the count of any subtree wholly inside b instead of walking it.
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockfreeQuadtree<Coord, FixedCapacity>::tally(const BoundingBox& b)
+{
+  if(!boundary.Intersects(b))
+    return 0;
+  // a move whose lowest common node is this takes its point off count before it puts it back
+  while(b.Contains(boundary))
+  {
+    const uint64_t m = moving.load();
+    const size_t n = count.load();
+    if(!underway(m) && moving.load() == m)
+      return n;
+    pause();
+  }
+
+  while(true)
   {
-    if(!std::binary_search(hazards.begin(), hazards.end(), *i))
+    const uint64_t s = state.load();
+    const uint64_t m = moving.load();
+    if(kind(s) == MERGING || underway(m))
+    {
+      pause();
+      continue;
+    }
+    size_t n = 0;
+    if(kind(s) == LEAF)
     {
-      delete (*i)->First;
-      delete (*i);
-      i = deleteWithNodeList.erase(i);
+      bool help;
+      {
+        Guard guard(reclamation);
+        Bucket* bucket = guard.Protect(points);
+        if(bucket == nullptr)
+          continue;
+        const Destination* target = bucket->Target.load();
+        help = target != nullptr && target != &frozen;
+        const auto tick = [&n] (const Point&) {++n;};
+        if(!help)
+          forEachPoint(bucket, b, boundary, tick);
+      }
+      if(help)
+      {
+        QUADTREE_COUNT(QueryHelps);
+        subdivide();
+        continue;
+      }
     }
     else
-      ++i;
+    {
+      for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      {
+        BasicLockfreeQuadtree* c = child(quadrant).load();
+        if(c != nullptr)
+          n += c->tally(b);
+      }
+    }
+
+    if(state.load() != s || moving.load() != m)
+    {
+      QUADTREE_COUNT(QueryRestarts);
+      continue;
+    }
+    return n;
   }
-//  return deleteList.empty() && deleteWithNodeList.empty();
 }
 
-/// @return whether there is nothing more for this thread to delete, i.e. whether this thread's delete lists are empty.
-bool LockfreeQuadtree::ThreadCanComplete()
+template <typename Coord, size_t FixedCapacity>
+vector<Point> BasicLockfreeQuadtree<Coord, FixedCapacity>::Nearest(const Point& p, size_t k)
 {
-  return deleteWithNodeList.empty() && deleteList.empty();
+  ownWrites();
+  Guard pin(Reclamation::Epoch);
+  NearestPoints best(p, k);
+  if(k == 0)
+    return best.Take();
+  NearestQueue<BasicLockfreeQuadtree> queue;
+  queue.push({DistanceSquared(p, boundary), this});
+  while(!queue.empty() && queue.top().Distance < best.Worst())
+  {
+    BasicLockfreeQuadtree* node = queue.top().N;
+    queue.pop();
+    node->searchNearest(p, best, queue);
+  }
+  return best.Take();
 }
 
-LockfreeQuadtree::HazardPointer* LockfreeQuadtree::HazardPointer::Acquire()
+/// A leaf's points, or an internal node's children, are only used if the node didn't change while they were read.
+/// Otherwise some points may already be elsewhere, and using both would find them twice.
+/// A leaf frozen by its parent's merge doesn't change; its moved points are still counted here, and the parent isn't searched again.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::searchNearest(const Point& p, NearestPoints& best, NearestQueue<BasicLockfreeQuadtree>& queue)
 {
-  // try to reuse a released HazardPointer
-  for(HazardPointer* p = LockfreeQuadtree::HazardPointer::head.load(); p != nullptr; p = p->Next)
+  vector<Point>& scanned = nearestBuffer;
+  while(true)
   {
-    if(p->active.test_and_set())
+    const uint64_t s = state.load();
+    if(kind(s) == MERGING)
+    {
+      pause();
       continue;
-    return p;
-  }
-  // no old released HazardPointers. Allocate a new one
-  HazardPointer* p = new HazardPointer();
-  p->active.test_and_set();
-  p->Hazard.store(nullptr);
-  /// @todo change this to a for loop. Because I like for.
-  HazardPointer* old;
-  do {
-    old = LockfreeQuadtree::HazardPointer::head.load();
-    p->Next = old;
-  } while(!LockfreeQuadtree::HazardPointer::head.compare_exchange_strong(old, p));
-  return p;
+    }
+    if(kind(s) == INTERNAL)
+    {
+      BasicLockfreeQuadtree* children[] = {Nw.load(), Ne.load(), Sw.load(), Se.load()};
+      if(state.load() != s)
+        continue;
+      for(BasicLockfreeQuadtree* child : children)
+        queue.push({DistanceSquared(p, child->boundary), child});
+      return;
+    }
+
+    bool help;
+    {
+      Guard guard(reclamation);
+      Bucket* localPoints = guard.Protect(points);
+      if(localPoints == nullptr)
+        continue;
+      const Destination* target = localPoints->Target.load();
+      help = target != nullptr && target != &frozen;
+      if(!help)
+      {
+        scanned.clear();
+        const double worst = best.Worst();
+        for(Bucket* bucket = localPoints; bucket != nullptr; bucket = bucket->Overflow.load())
+        {
+          const Coord* xs = bucket->Xs();
+          const Coord* ys = bucket->Ys();
+          const uint64_t* ids = bucket->IDs();
+          const std::atomic<uint8_t>* states = bucket->States();
+          const bool anyDead = bucket->Dead.load() != 0;
+          for(size_t i = 0, end = bucket->Published.load(); i != end; ++i)
+          {
+            const double dx = xs[i] - p.X;
+            const double dy = ys[i] - p.Y;
+            if(dx * dx + dy * dy < worst && (!anyDead || states[i].load() != Bucket::DEAD))
+              scanned.push_back(Point(xs[i], ys[i], ids[i]));
+          }
+        }
+      }
+    }
+    if(help)
+    {
+      QUADTREE_COUNT(QueryHelps);
+      subdivide();
+      continue;
+    }
+    if(state.load() == s)
+    {
+      for(const Point& found : scanned)
+        best.Offer(found.X, found.Y, found.ID);
+      return;
+    }
+  }
 }
+
+template <typename Coord, size_t FixedCapacity>
+std::unique_ptr<Snapshot> BasicLockfreeQuadtree<Coord, FixedCapacity>::Freeze()
+{
+  return Snapshot::Build(Query(boundary), boundary, capacity);
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockfreeQuadtree<Coord, FixedCapacity>::Query(const BoundingBox& b, const PointVisitor& visit)
+{
+  vector<Point> found;
+  found.swap(queryBuffer); // swapped out rather than used in place, in case visit queries again
+  found.clear();
+  Query(b, found);
+  for(const Point& p : found)
+    visit(p);
+  found.swap(queryBuffer);
+}
+
+/// @return whether there is nothing more for this thread to delete, i.e. whether this thread's delete lists are empty.
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockfreeQuadtree<Coord, FixedCapacity>::ThreadCanComplete()
+{
+  return quadtree::ThreadCanComplete();
+}
+
+template <typename Coord, size_t FixedCapacity>
+typename BasicLockfreeQuadtree<Coord, FixedCapacity>::Destination BasicLockfreeQuadtree<Coord, FixedCapacity>::frozen;
+
+template class BasicLockfreeQuadtree<double, 0>;
+template class BasicLockfreeQuadtree<float, 0>;
+template class BasicLockfreeQuadtree<double, 16>;
+template class BasicLockfreeQuadtree<float, 16>;
+template class BasicLockfreeQuadtree<int32_t, 0>;
+template class BasicLockfreeQuadtree<int32_t, 16>;
 }
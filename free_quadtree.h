@@ -3,63 +3,316 @@
 
 #include <vector>
 #include <atomic>
-//#include <memory>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
 #include "quadtree.h"
+#include "pool.h"
+#include "reclaim.h"
+#include "morton.h"
+#include "nearest.h"
+#include "snapshot.h"
+#include "tasks.h"
 
 namespace quadtree 
 {
-class LockfreeQuadtree : public Quadtree
+/// What a thread's own reads see of the inserts it has buffered, in a tree that buffers them
+enum class Buffered
+{
+  Hidden,        ///< nothing, until it calls Flush() or its buffer fills
+  ReadYourWrites ///< all of them: its queries, counts, nearest searches and deletes flush its buffer first
+};
+
+/// How a lock-free tree's queries read nodes that change under them
+enum class Consistency
+{
+  /// a subtree that changed while it was read is read again, until it reads the same before and after.
+  /// Under heavy writes that can go on indefinitely, and a reader that finds a leaf splitting helps split it first.
+  /// Moves make it worse: a reader waits out every Move under a node it's reading, and reads the node again if one finished,
+  /// so a steady stream of moves between distant points, whose lowest common node is the root, can starve queries of the
+  /// whole boundary. Bounded doesn't wait for them.
+  Restarting,
+  /// every node is read once. A reader takes whichever of a node's bucket and children is published, and never helps,
+  /// waits or retries. Every point in the tree throughout the query is found, once, and every point found was in the
+  /// tree at some moment during it; a point inserted or deleted meanwhile may or may not be.
+  Bounded
+};
+
+/// A lock-free tree whose leaves store coordinates as Coord, double, float or int32_t, and split past FixedCapacity points.
+/// FixedCapacity 0 means the constructor's capacity is used instead. Through the Quadtree interface points are still doubles:
+/// a tree of floats rounds each point it's given to the nearest float, and that's the point it stores and returns.
+/// A tree of integers rounds each to the nearest integer, and covers IntegerBoundary() of the boundary it's given.
+/// Each node's quadrant for a point is then one bit of each coordinate, and the tree is never more than
+/// IntegerLevels() deep: a leaf that deep holds a single coordinate, and only chains buckets.
+/// There's no fanout parameter: every node has exactly four children, one per BoundingBox::Quadrant(), and a split or
+/// merge replaces them all at once.
+/// LockfreeQuadtree is the double, runtime-capacity instantiation; free_quadtree.cpp compiles the ones listed below it.
+template <typename Coord = double, size_t FixedCapacity = 0>
+class BasicLockfreeQuadtree final : public Quadtree
 {
 public:
-  // @todo create destructor, that deletes all the newed children
-  LockfreeQuadtree(BoundingBox boundary, size_t capacity);
-  virtual ~LockfreeQuadtree() {}
+  /// @param allocation where leaf buckets and child nodes come from. Children use the same allocation as their parent.
+  /// @param reclamation how buckets are freed once their points move elsewhere. Children use the same reclamation as their parent.
+  /// Nodes removed by a merge are always freed by epoch, whatever this says, so every operation also pins the epoch.
+  BasicLockfreeQuadtree(BoundingBox boundary, size_t capacity, Allocation allocation = Allocation::Heap, Reclamation reclamation = Reclamation::HazardPointer);
+  /// deletes the points and all children. Must not run concurrently with anything else on the tree.
+  virtual ~BasicLockfreeQuadtree();
 
   virtual bool               Insert(const Point& p);
-//  virtual bool               Delete(const Point& p);
-  virtual std::vector<Point> Query(const BoundingBox&);
+  virtual void               Flush();
+  virtual bool               Delete(const Point& p);
+  virtual size_t             Delete(const BoundingBox& b);
+  /// Only the lowest node holding both positions is involved. Within one leaf the point is deleted from its bucket and
+  /// added to the same bucket again; otherwise it's deleted from one child and inserted into another, below that node.
+  /// Query, Count and QueryBatch find it at one position or the other, never both or neither. Bounded queries,
+  /// ParallelQuery and Nearest don't read again, so they may.
+  /// That costs the readers: a Query waits while a move is underway anywhere below a node it's reading, and reads the node
+  /// again if one finished meanwhile. A move across the boundary puts that node at the root, so a steady stream of long
+  /// moves can hold off a Restarting query of a large box indefinitely. Use Consistency::Bounded, or LockQuadtree,
+  /// where those matter.
+  virtual bool               Move(const Point& from, const Point& to);
+  virtual void               Query(const BoundingBox&, std::vector<Point>& found);
+  virtual void               Query(const BoundingBox&, const PointVisitor& visit);
+  virtual void               Query(const Circle& c, std::vector<Point>& found);
+  virtual void               Query(const ConvexPolygon& c, std::vector<Point>& found);
+  using Quadtree::Query;
+  virtual void               QueryIDs(const BoundingBox&, std::vector<uint64_t>& found);
+  virtual void               QueryBatch(const std::vector<BoundingBox>& boxes, std::vector<std::vector<Point>>& found);
+  virtual size_t             Count(const BoundingBox&);
+  virtual std::vector<Point> Nearest(const Point& p, size_t k);
   virtual BoundingBox        Boundary() {return boundary;}
+  /// Query, split across pool's workers. Each internal node above grain points hands its children out as separate tasks;
+  /// smaller subtrees are queried whole. Each worker fills its own buffer and they're appended to found at the end,
+  /// so the points come in no particular order.
+  void ParallelQuery(const BoundingBox& b, std::vector<Point>& found, TaskPool& pool, size_t grain = 4096);
+  /// @return a read-only, pointerless copy of the points a query of the whole boundary finds, with leaves of this tree's capacity.
+  /// Safe to call alongside anything else.
+  std::unique_ptr<Snapshot> Freeze();
   bool ThreadCanComplete(); ///< @todo not sure I like this. Make gc() call until success on each func?
 
+  /// Inserts many points with one descent: at each node they're split between the children, and each leaf takes its share
+  /// with one reservation and one update of each count on the way. points is reordered.
+  /// @return the number inserted. Those outside the boundary aren't.
+  size_t InsertBatch(std::vector<Point>& points);
+  /// Turns on write combining. Each thread's inserts collect in a buffer of its own, and go in with InsertBatch() once
+  /// there are batch of them or the thread calls Flush(). Insert() still returns false for a point outside the boundary.
+  /// A thread must Flush() before it exits, and before the tree is destroyed: what it still has buffered then is discarded,
+  /// never inserted, here or into any other tree.
+  /// Call before anything inserts.
+  /// @param batch 0 to turn it off again. The calling thread's buffer is flushed; other threads must Flush() their own.
+  void BufferInserts(size_t batch, Buffered visibility = Buffered::ReadYourWrites);
+  /// Sets how Query and Count read the tree. QueryBatch, ParallelQuery and Nearest always restart.
+  /// Call before anything queries.
+  void QueryConsistency(Consistency c) {consistency = c;}
+
+  /// Builds a tree from a batch of points at once, instead of inserting them one by one.
+  /// The points are Morton-sorted in parallel and the top levels' subtrees built on separate threads.
+  /// The result is an ordinary tree, ready for concurrent inserts and queries. Points outside boundary are dropped.
+  /// @param threads 0 for one per hardware thread
+  static std::unique_ptr<BasicLockfreeQuadtree> BulkLoad(const std::vector<Point>& points, BoundingBox boundary, size_t capacity,
+                                                         Allocation allocation = Allocation::Heap,
+                                                         Reclamation reclamation = Reclamation::HazardPointer,
+                                                         unsigned int threads = 0);
+
   BoundingBox boundary; ///< @todo change to shared_ptr ?
 
   // @todo rename these and vars, swap case
   // these are here so the gui can get their boundaries.
-  LockfreeQuadtree* nw() {return Nw.load();}
-  LockfreeQuadtree* ne() {return Ne.load();}
-  LockfreeQuadtree* sw() {return Sw.load();}
-  LockfreeQuadtree* se() {return Se.load();}
+  BasicLockfreeQuadtree* nw() {return Nw.load();}
+  BasicLockfreeQuadtree* ne() {return Ne.load();}
+  BasicLockfreeQuadtree* sw() {return Sw.load();}
+  BasicLockfreeQuadtree* se() {return Se.load();}
 
 private:
-  LockfreeQuadtree();
+  struct Destination;
+  /// A lock-free leaf's points, stored inline after the header in one cache-line-aligned block:
+  /// every X, then every Y, then every ID, then a state byte per slot, so queries can filter several points at once.
+  /// An insert claims a slot with one fetch_add on Reserved, writes it, then publishes it by moving Published past it.
+  /// Slots are published in order, so a reader needs one load of Published and then scans the array linearly.
+  /// A delete marks its slot dead, and moving the bucket's points elsewhere marks each slot moved. Both are CASes from live,
+  /// so a point is either deleted or moved, never both.
+  /// Once Reserved reaches Capacity the bucket is full for good, and its live points move out to wherever Target says.
+  class alignas(64) Bucket
+  {
+  public:
+    enum Slot : uint8_t
+    {
+      LIVE,
+      DEAD,
+      MOVED
+    };
 
-  std::atomic<PointList*> points;
-  std::atomic<LockfreeQuadtree*> Nw;
-  std::atomic<LockfreeQuadtree*> Ne;
-  std::atomic<LockfreeQuadtree*> Sw;
-  std::atomic<LockfreeQuadtree*> Se;
+    static Bucket* Make(Allocation a, size_t capacity);
+    static void Destroy(Allocation a, Bucket* b);
 
-  void subdivide();
-  void disperse();
-  static void gc(); ///< this function is thread-specific. It collects garbage specific to the thread, not the tree.
-  std::atomic<bool> subdividing;
+    /// @return false if the bucket is full
+    bool Add(const Point& p);
+    /// adds as many of the n points as fit, with one reservation
+    /// @return how many went in, from the front of points. 0 if the bucket is full.
+    size_t Add(const Point* points, size_t n);
+    /// blocks until every claimed slot is written. Only meaningful once the bucket is full.
+    void WaitFull();
+    /// fills the bucket so no later Add succeeds, then waits for the Adds already in
+    /// @return the number of slots written
+    size_t Seal();
+    /// marks one live point equal to p, ID included, dead
+    /// @return false if there was none
+    bool Remove(const Point& p);
+    /// marks every live point inside b dead
+    /// @return the number marked
+    size_t Remove(const BoundingBox& b);
+    Coord* Xs() {return reinterpret_cast<Coord*>(this + 1);}
+    Coord* Ys() {return Xs() + Capacity;}
+    uint64_t* IDs() {return reinterpret_cast<uint64_t*>(Ys() + Capacity);}
+    std::atomic<uint8_t>* States() {return reinterpret_cast<std::atomic<uint8_t>*>(IDs() + Capacity);}
+
+    const size_t Capacity;
+    std::atomic<size_t> Reserved;  ///< slots claimed by inserts. Keeps counting past Capacity once full.
+    std::atomic<size_t> Published; ///< slots [0, Published) are written
+    std::atomic<size_t> Dispersed; ///< slots claimed by disperse()
+    std::atomic<size_t> Moved;     ///< slots disperse() has finished with
+    std::atomic<size_t> Dead;      ///< slots deleted
+    /// where points go once this is full, in a leaf at the precision limit. Each is twice the size of the one before,
+    /// so n points at one spot take about log2(n / capacity) buckets, not n / capacity.
+    std::atomic<Bucket*> Overflow;
+    /// where the points are going, once the bucket is full or a merge has frozen it.
+    /// Set by CAS from null; only a merge that backs out ever clears it again.
+    std::atomic<Destination*> Target;
 
-  class HazardPointer
-  {
-  public:
-    std::atomic<PointList*> Hazard; // this MUST be atomic. It could be half-changed then referenced // the hazardous pointer. Change to PointList?
-    HazardPointer* Next;
   private:
-    std::atomic_flag active;
+    explicit Bucket(size_t capacity);
+    static size_t bytes(size_t capacity);
+  };
 
+  /// Where the live points of a full bucket go. Whoever sets the bucket's Target has already copied them there, privately;
+  /// helpers only mark each old slot moved, or, if it was deleted since, delete the copy too. Freed with the bucket.
+  struct Destination
+  {
+    BasicLockfreeQuadtree* Children[4]; ///< new children, by BoundingBox::Quadrant(), when the leaf splits
+    Bucket* Compacted;                  ///< or a fresh bucket for the same leaf, when enough of the old one is dead
+    /// for each slot of the old bucket, where its copy went: the quadrant, above SLOT_BITS, and the slot in that child's
+    /// bucket, or in Compacted. NOWHERE if it was already dead.
+    std::vector<uint32_t> Slots;
 
-    static std::atomic<HazardPointer*> head;
-//    static std::atomic_size_t length;
-  public:
-    static HazardPointer* Head() {return head.load();}
-    static HazardPointer* Acquire();
-    static void Release(HazardPointer* p) {p->Hazard.store(nullptr);p->active.clear();}
+    static const unsigned int SLOT_BITS = 30;
+    static const uint32_t NOWHERE = UINT32_MAX;
+  };
+
+  /// the Target of a bucket a merge has frozen. No points go anywhere; the merge takes them.
+  static Destination frozen;
+
+  /// @return p as it's stored, rounded to Coord
+  static Point stored(const Point& p)
+  {
+    return RoundedTo<Coord>(p);
+  }
+
+  /// how a private operation on a subtree ended
+  enum class Outcome
+  {
+    Done,
+    Outside, ///< the point isn't in this subtree
+    Retry    ///< a merge has frozen this subtree. The caller waits for it and tries the parent again.
   };
+  /// what a node is, in the low bits of state
+  enum Kind : uint64_t
+  {
+    LEAF,
+    INTERNAL,
+    MERGING ///< folding its children back into itself. Everything else waits.
+  };
+  static uint64_t kind(uint64_t state) {return state & 3;}
+  /// @return the next version of state, of kind k
+  static uint64_t advance(uint64_t state, Kind k) {return ((state >> 2) + 1) << 2 | k;}
+
+  const Allocation allocation;
+  const Reclamation reclamation;
+  /// points a leaf holds before it splits; a merged bucket may hold more. FixedCapacity, when that isn't 0.
+  const size_t capacity;
+  std::atomic<Bucket*> points;
+  std::atomic<BasicLockfreeQuadtree*> Nw;
+  std::atomic<BasicLockfreeQuadtree*> Ne;
+  std::atomic<BasicLockfreeQuadtree*> Sw;
+  std::atomic<BasicLockfreeQuadtree*> Se;
+  /// points in this subtree. Moving points down to children or up in a merge doesn't change it.
+  std::atomic<size_t> count;
+  /// Moves whose lowest common node is this: how many are under way in the low bits, and above them how many have finished.
+  /// Readers that go again when state changes wait while one is under way, and go again if this changed too.
+  std::atomic<uint64_t> moving;
+  static const uint64_t MOVE_FINISHED = uint64_t(1) << 32;
+  static bool underway(uint64_t m) {return (m & (MOVE_FINISHED - 1)) != 0;}
+  /// a Kind, and above it a version that's bumped whenever the points bucket or the children are replaced.
+  /// A reader that sees the same state before and after reading this node saw one consistent version of it.
+  std::atomic<uint64_t> state;
+
+  /// @return the child for a BoundingBox::Quadrant()
+  std::atomic<BasicLockfreeQuadtree*>& child(unsigned int quadrant);
+  Outcome insert(const Point& p);
+  Outcome erase(const Point& p);
+  size_t erase(const BoundingBox& b);
+  /// moves from, which is in this node, to to, which is too
+  /// @param parent this node's parent, or nullptr at the root
+  Outcome move(BasicLockfreeQuadtree* parent, const Point& from, const Point& to);
+  /// inserts a prefix of [begin, end), which is all inside this node, reordering the range so the prefix is what went in.
+  /// The rest is left when a merge freezes this subtree; the caller waits for it and tries again, as with insert().
+  /// @return the length of the prefix
+  size_t insertBatch(Point* begin, Point* end);
+  /// flushes this thread's buffered inserts, if its reads are to see them
+  void ownWrites();
+  /// @param r a BoundingBox, Circle or ConvexPolygon
+  /// @param found gets each point found, or, for a vector of IDs, just its ID
+  template <typename Region, typename Found>
+  void query(const Region& r, std::vector<Found>& found);
+  /// @return this node's bucket, protected by guard, or nullptr and its four children. Whichever it is, it's current.
+  Bucket* current(Guard& guard, BasicLockfreeQuadtree* children[4]);
+  template <typename Region, typename Found>
+  void boundedQuery(const Region& r, std::vector<Found>& found);
+  size_t boundedTally(const BoundingBox& b);
+  /// a box of a QueryBatch still being answered, and how many points it had found when the current node was entered
+  struct BatchEntry
+  {
+    uint32_t Box;
+    size_t Start;
+  };
+  /// answers the boxes active[begin, end()) for this subtree. Children push their own entries past end(), and pop them.
+  void queryBatch(const std::vector<BoundingBox>& boxes, std::vector<std::vector<Point>>& found, std::vector<BatchEntry>& active, size_t begin);
+  void parallelQuery(const BoundingBox& b, TaskPool& pool, size_t grain, std::vector<std::vector<Point>>& buffers, unsigned int worker);
+  size_t tally(const BoundingBox& b);
+  /// starts or helps moving the points out of this leaf's full bucket
+  void subdivide();
+  /// @return the quadrant of this node p belongs in, given the children it has or is about to have
+  unsigned int quadrantOf(BasicLockfreeQuadtree* const* children, const Point& p) const;
+  /// the children can't split any further
+  bool atPrecisionLimit() const;
+  void disperse(Bucket* old, Destination* target);
+  void finish(Bucket* old, Destination* target);
+  /// folds the children back into this node if they're leaves holding few enough points between them
+  void merge();
+  /// offers this leaf's points to best, or, if this has children, queues them
+  void searchNearest(const Point& p, NearestPoints& best, NearestQueue<BasicLockfreeQuadtree>& queue);
+  /// turns this private, unpublished leaf into the subtree for the sorted points [begin, end)
+  /// @param misfits gets the points that rounding put in a leaf whose boundary doesn't contain them
+  void build(const MortonPoint* begin, const MortonPoint* end, unsigned int level, unsigned int parallelLevels, std::vector<Point>& misfits);
+  /// the boundary is at the limit of double precision, or holds one integer. Full buckets chain to an overflow bucket
+  /// instead of subdividing.
+  bool unbounded;
+  /// integer trees only: the IntegerLevels() of the boundary
+  unsigned int levels;
+  /// inserts each thread buffers before it flushes them; 0 if they aren't buffered. Only the root's is used.
+  size_t combine;
+  /// tells this tree's buffers apart from those of a tree that was at the same address. 0 until BufferInserts().
+  uint64_t generation;
+  Buffered visibility;
+  Consistency consistency;
 };
+
+typedef BasicLockfreeQuadtree<double, 0> LockfreeQuadtree;
+extern template class BasicLockfreeQuadtree<double, 0>;
+extern template class BasicLockfreeQuadtree<float, 0>;
+extern template class BasicLockfreeQuadtree<double, 16>;
+extern template class BasicLockfreeQuadtree<float, 16>;
+extern template class BasicLockfreeQuadtree<int32_t, 0>;
+extern template class BasicLockfreeQuadtree<int32_t, 16>;
 }
 #endif // quadtreeH
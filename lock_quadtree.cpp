@@ -2,126 +2,737 @@
 #include <vector>
 #include "quadtree.h"
 #include "lock_quadtree.h"
+#include "filter.h"
 #include <atomic>
 #include <memory>
 #include <functional> //debug
 #include <thread> //debug
 #include <algorithm>
 #include <mutex>
+#include <shared_mutex>
+#include <cmath>
+#include <limits>
+#include <iterator>
+#include <type_traits>
+#include <cassert>
 namespace
 {
 using std::vector;
 using std::cout;
 using std::endl;
+
+/// Deleter for a node a merge has folded into its parent
+template <typename Tree>
+void freeNode(void* p, quadtree::Allocation)
+{
+  delete static_cast<Tree*>(p);
+}
 }
 
 namespace quadtree
 {
-LockQuadtree::LockQuadtree(BoundingBox boundary_, size_t capacity_)
-  : boundary(boundary_)
-  , capacity(capacity_)
+template <typename Coord, size_t FixedCapacity>
+BasicLockQuadtree<Coord, FixedCapacity>::BasicLockQuadtree(BoundingBox boundary_, size_t capacity_)
+  : boundary(std::is_integral<Coord>::value ? IntegerBoundary(boundary_) : boundary_)
+  // a child at the precision limit is made with the largest capacity, whatever FixedCapacity says, as is a single integer
+  , capacity(std::is_integral<Coord>::value && IntegerLevels(boundary) == 0 ? std::numeric_limits<size_t>::max()
+             : FixedCapacity == 0 || capacity_ == std::numeric_limits<size_t>::max() ? capacity_ : FixedCapacity)
+  , leafCapacity(capacity)
   , Nw(nullptr)
   , Ne(nullptr)
   , Sw(nullptr)
   , Se(nullptr)
+  , count(0)
+  , levels(std::is_integral<Coord>::value ? IntegerLevels(boundary) : 0)
 {}
 
-bool LockQuadtree::Insert(const Point& p)
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockQuadtree<Coord, FixedCapacity>::Insert(const Point& given)
 {
+  const Point p = stored(given);
   if(!boundary.Contains(p))
     return false;
 
-  pointsMutex.lock();
-  if(points.size() < capacity)
+  // Internal nodes are walked through with shared locks. Only the leaf that takes the point is locked exclusively.
+  // Each node stays locked until the one below it is, so nothing can change in between;
+  // a merge needs the parent exclusively, so it can't take the node from under us either.
+  // The nodes whose counts this has bumped, so a failed insert can take them back. It does that before letting go of the
+  // last lock it holds: none of them can be merged away while a node below them is locked.
+  SmallVector<BasicLockQuadtree*, 64> counted;
+  const auto uncount = [&counted] ()
+  {
+    for(BasicLockQuadtree* n : counted)
+      n->count.fetch_sub(1);
+    return false;
+  };
+  BasicLockQuadtree* node = this;
+  SharedLock parentLock;
+  UniqueLock lock;
+  while(true)
+  {
+    SharedLock probe(node->pointsMutex);
+    if(node->Nw != nullptr)
+    {
+      node->count.fetch_add(1);
+      counted.push_back(node);
+      parentLock = std::move(probe); // releases the parent, now that its child is locked
+      node = node->child(p);
+      if(node == nullptr)
+        return uncount();
+      continue;
+    }
+    probe.unlock();
+    lock = UniqueLock(node->pointsMutex);
+    if(node->Nw == nullptr) // nobody subdivided it while it was unlocked
+      break;
+    lock.unlock();
+  }
+  if(parentLock.owns_lock())
+    parentLock.unlock();
+
+  if(node->xs.size() < node->capacity)
   {
-    points.push_back(p);
-    pointsMutex.unlock();
+    node->xs.push_back(static_cast<Coord>(p.X));
+    node->ys.push_back(static_cast<Coord>(p.Y));
+    node->ids.push_back(p.ID);
+    node->count.fetch_add(1);
     return true;
   }
 
-  if(!points.empty())
-    subdivide();
+  node->subdivide();
+  node->count.fetch_add(1);
+  counted.push_back(node);
+  // the new children are only reachable through node, which we still hold
+  BasicLockQuadtree* child = node->child(p);
+  if(child == nullptr || !child->Insert(p))
+    return uncount();
+  return true;
+}
 
-  const bool ok = Nw->Insert(p) || Ne->Insert(p) || Sw->Insert(p) || Se->Insert(p);
-  pointsMutex.unlock();
-  return ok;
+/// For integers, the child p's bits pick; otherwise the first whose boundary contains p, in the order Insert has always tried them.
+/// p must be inside this node.
+template <typename Coord, size_t FixedCapacity>
+BasicLockQuadtree<Coord, FixedCapacity>* BasicLockQuadtree<Coord, FixedCapacity>::child(const Point& p)
+{
+  if(std::is_integral<Coord>::value)
+  {
+    BasicLockQuadtree* children[] = {Nw, Ne, Sw, Se};
+    return children[IntegerQuadrant(p, boundary, levels)];
+  }
+  if(Nw->boundary.Contains(p))
+    return Nw;
+  if(Ne->boundary.Contains(p))
+    return Ne;
+  if(Sw->boundary.Contains(p))
+    return Sw;
+  if(Se->boundary.Contains(p))
+    return Se;
+  return nullptr;
+}
+
+/// Walks down with shared locks held all the way, so no node on the path can be merged away,
+/// then merges on the way back up wherever enough points have gone.
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockQuadtree<Coord, FixedCapacity>::Delete(const Point& p)
+{
+  const Point q = stored(p);
+  return boundary.Contains(q) && erase(q);
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockQuadtree<Coord, FixedCapacity>::Delete(const BoundingBox& b)
+{
+  return erase(b);
+}
+
+/// Points equal to p on a shared edge may be in any child whose boundary contains it, so each is tried.
+/// Integer points are never on a shared edge.
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockQuadtree<Coord, FixedCapacity>::erase(const Point& p)
+{
+  SharedLock lock(pointsMutex);
+  if(Nw != nullptr)
+  {
+    bool erased = false;
+    if(std::is_integral<Coord>::value)
+      erased = child(p)->erase(p);
+    else
+    {
+      BasicLockQuadtree* children[] = {Nw, Ne, Sw, Se};
+      for(BasicLockQuadtree* child : children)
+      {
+        if(child->boundary.Contains(p) && child->erase(p))
+        {
+          erased = true;
+          break;
+        }
+      }
+    }
+    if(!erased)
+      return false;
+    count.fetch_sub(1);
+    lock.unlock();
+    merge();
+    return true;
+  }
+  lock.unlock();
+
+  UniqueLock unique(pointsMutex);
+  if(Nw != nullptr) // subdivided while it was unlocked
+  {
+    unique.unlock();
+    return erase(p);
+  }
+  for(size_t i = 0, end = xs.size(); i != end; ++i)
+  {
+    if(xs[i] == p.X && ys[i] == p.Y && ids[i] == p.ID)
+    {
+      xs[i] = xs.back();
+      ys[i] = ys.back();
+      ids[i] = ids.back();
+      xs.pop_back();
+      ys.pop_back();
+      ids.pop_back();
+      count.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Walks down as Insert does while one child holds both points, and locks the lowest node that holds both exclusively.
+/// Queries hold each node's lock while they walk below it, so none is partway through that subtree while the point moves.
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockQuadtree<Coord, FixedCapacity>::Move(const Point& from, const Point& to)
+{
+  const Point f = stored(from);
+  const Point t = stored(Point(to.X, to.Y, from.ID));
+  if(!boundary.Contains(f) || !boundary.Contains(t))
+    return false;
+
+  BasicLockQuadtree* node = this;
+  SharedLock parentLock;
+  UniqueLock lock;
+  while(true)
+  {
+    SharedLock probe(node->pointsMutex);
+    BasicLockQuadtree* next = node->Nw != nullptr ? node->holding(f, t) : nullptr;
+    if(next != nullptr)
+    {
+      parentLock = std::move(probe);
+      node = next;
+      continue;
+    }
+    probe.unlock();
+    lock = UniqueLock(node->pointsMutex);
+    if(node->Nw == nullptr || node->holding(f, t) == nullptr) // nobody subdivided it while it was unlocked
+      break;
+    lock.unlock();
+  }
+  if(parentLock.owns_lock())
+    parentLock.unlock();
+
+  if(node->Nw == nullptr)
+  {
+    for(size_t i = 0, end = node->xs.size(); i != end; ++i)
+    {
+      if(node->xs[i] == f.X && node->ys[i] == f.Y && node->ids[i] == f.ID)
+      {
+        node->xs[i] = static_cast<Coord>(t.X);
+        node->ys[i] = static_cast<Coord>(t.Y);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // resolved before anything is erased, so a point with nowhere to go stays where it is
+  BasicLockQuadtree* into = node->child(t);
+  if(into == nullptr)
+    return false;
+  // the children keep their own locks for anything already inside them
+  bool erased = false;
+  if(std::is_integral<Coord>::value)
+    erased = node->child(f)->erase(f);
+  else
+  {
+    for(BasicLockQuadtree* child : {node->Nw, node->Ne, node->Sw, node->Se})
+    {
+      if(child->boundary.Contains(f) && child->erase(f))
+      {
+        erased = true;
+        break;
+      }
+    }
+  }
+  if(!erased)
+    return false;
+  if(into->Insert(t))
+    return true;
+  // still under node's exclusive lock, so nobody saw it gone
+  BasicLockQuadtree* back = node->child(f);
+  const bool restored = back != nullptr && back->Insert(f);
+  assert(restored);
+  (void)restored;
+  return false;
+}
+
+/// @return the child that to goes in, if from can't be in any other; otherwise nullptr. This has children.
+template <typename Coord, size_t FixedCapacity>
+BasicLockQuadtree<Coord, FixedCapacity>* BasicLockQuadtree<Coord, FixedCapacity>::holding(const Point& from, const Point& to)
+{
+  BasicLockQuadtree* c = child(to);
+  if(std::is_integral<Coord>::value)
+    return child(from) == c ? c : nullptr;
+  for(BasicLockQuadtree* other : {Nw, Ne, Sw, Se})
+  {
+    if((other == c) != other->boundary.Contains(from))
+      return nullptr;
+  }
+  return c;
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockQuadtree<Coord, FixedCapacity>::erase(const BoundingBox& b)
+{
+  if(!boundary.Intersects(b))
+    return 0;
+  SharedLock lock(pointsMutex);
+  if(Nw != nullptr)
+  {
+    BasicLockQuadtree* children[] = {Nw, Ne, Sw, Se};
+    size_t n = 0;
+    for(BasicLockQuadtree* child : children)
+      n += child->erase(b);
+    count.fetch_sub(n);
+    lock.unlock();
+    if(n != 0)
+      merge();
+    return n;
+  }
+  lock.unlock();
+
+  UniqueLock unique(pointsMutex);
+  if(Nw != nullptr)
+  {
+    unique.unlock();
+    return erase(b);
+  }
+  size_t k = 0;
+  for(size_t i = 0, end = xs.size(); i != end; ++i)
+  {
+    if(!b.Contains(Point(xs[i], ys[i])))
+    {
+      xs[k] = xs[i];
+      ys[k] = ys[i];
+      ids[k] = ids[i];
+      ++k;
+    }
+  }
+  const size_t n = xs.size() - k;
+  xs.resize(k);
+  ys.resize(k);
+  ids.resize(k);
+  count.fetch_sub(n);
+  return n;
+}
+
+/// The children are locked exclusively under this node's exclusive lock, so nothing is left inside them.
+/// Their points are copied, not moved: a query that took the children before the merge may still walk them,
+/// which is why they're retired by epoch rather than deleted.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::merge()
+{
+  if(count.load() > leafCapacity / 2)
+    return;
+  UniqueLock lock(pointsMutex);
+  // with this and the children held, nothing is partway through the subtree, so count is exact
+  if(Nw == nullptr || count.load() > leafCapacity / 2)
+    return;
+  BasicLockQuadtree* children[] = {Nw, Ne, Sw, Se};
+  UniqueLock childLocks[4];
+  for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+  {
+    childLocks[quadrant] = UniqueLock(children[quadrant]->pointsMutex);
+    if(children[quadrant]->Nw != nullptr || children[quadrant]->leafCapacity == std::numeric_limits<size_t>::max())
+      return;
+  }
+  for(BasicLockQuadtree* child : children)
+  {
+    xs.insert(xs.end(), child->xs.begin(), child->xs.end());
+    ys.insert(ys.end(), child->ys.begin(), child->ys.end());
+    ids.insert(ids.end(), child->ids.begin(), child->ids.end());
+  }
+  Nw = Ne = Sw = Se = nullptr;
+  capacity = leafCapacity;
+  for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+  {
+    childLocks[quadrant].unlock();
+    Retire(Reclamation::Epoch, children[quadrant], freeNode<BasicLockQuadtree>, Allocation::Heap);
+  }
 }
 
-void LockQuadtree::subdivide()
+/// Below about a millionth of a unit a double leaf stops splitting. An integer leaf stops exactly where it holds one coordinate.
+template <typename Coord, size_t FixedCapacity>
+bool BasicLockQuadtree<Coord, FixedCapacity>::atPrecisionLimit() const
 {
+  if(std::is_integral<Coord>::value)
+    return levels == 1;
   const double dx = 0.000001;
-  // don't subdivide further if we reach the limits of double precision
-  if(fabs(boundary.HalfDimension.X/2.0) < dx || fabs(boundary.HalfDimension.Y/2.0) < dx)
+  return fabs(boundary.HalfDimension.X/2.0) < dx || fabs(boundary.HalfDimension.Y/2.0) < dx;
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::subdivide()
+{
+  // don't subdivide further if we reach the limits of precision
+  if(atPrecisionLimit())
     capacity = std::numeric_limits<size_t>::max();
 
-  const Point newHalf = {boundary.HalfDimension.X / 2.0, boundary.HalfDimension.Y / 2.0}; 
-  Point newCenter = {boundary.Center.X - boundary.HalfDimension.X/2.0, boundary.Center.Y - boundary.HalfDimension.Y/2.0};
-  BoundingBox newBoundary = {newCenter, newHalf};
-  Nw = new LockQuadtree(newBoundary, capacity);;
+  BasicLockQuadtree** children[] = {&Nw, &Ne, &Sw, &Se};
+  for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+    *children[quadrant] = new BasicLockQuadtree(boundary.Quadrant(quadrant), capacity);
 
-  newCenter = {boundary.Center.X + boundary.HalfDimension.X/2.0, boundary.Center.Y - boundary.HalfDimension.Y/2.0};
-  newBoundary = {newCenter, newHalf};
-  Ne = new LockQuadtree(newBoundary, capacity);
+  disperse();
+  capacity = 0;
+}
 
-  newCenter = {boundary.Center.X + boundary.HalfDimension.X/2.0, boundary.Center.Y + boundary.HalfDimension.Y/2.0};
-  newBoundary = {newCenter, newHalf};
-  Se = new LockQuadtree(newBoundary, capacity);
+/// The quadrants cover every point this node does, so each point has a child to go to.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::disperse()
+{
+  for(size_t i = 0, end = xs.size(); i != end; ++i)
+  {
+    Point p(xs[i], ys[i], ids[i]);
+    BasicLockQuadtree* c = child(p);
+    const bool ok = c != nullptr && c->Insert(p);
+    assert(ok);
+    (void)ok;
+  }
+  xs.clear();
+  ys.clear();
+  ids.clear();
+}
 
-  newCenter = {boundary.Center.X - boundary.HalfDimension.X/2.0, boundary.Center.Y + boundary.HalfDimension.Y/2.0};
-  newBoundary = {newCenter, newHalf};
-  Sw = new LockQuadtree(newBoundary, capacity);
+template <typename Coord, size_t FixedCapacity>
+std::unique_ptr<BasicLockQuadtree<Coord, FixedCapacity>> BasicLockQuadtree<Coord, FixedCapacity>::BulkLoad(const vector<Point>& points, BoundingBox boundary, size_t capacity, unsigned int threads)
+{
+  if(threads == 0)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  // an integer tree may cover more than boundary, so points are sorted within what it does cover
+  std::unique_ptr<BasicLockQuadtree> q(new BasicLockQuadtree(boundary, capacity));
+  vector<Point> rounded;
+  if(!std::is_same<Coord, double>::value)
+    std::transform(points.begin(), points.end(), std::back_inserter(rounded), stored);
+  const vector<MortonPoint> sorted = MortonSort(std::is_same<Coord, double>::value ? points : rounded, q->boundary, threads);
 
-  disperse();
+  unsigned int parallelLevels = 0;
+  for(unsigned int subtrees = 1; subtrees < threads; subtrees *= 4)
+    ++parallelLevels;
+
+  vector<Point> misfits;
+  q->build(sorted.data(), sorted.data() + sorted.size(), 0, parallelLevels, misfits);
+  for(const Point& p : misfits)
+    q->Insert(p);
+  return q;
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::build(const MortonPoint* begin, const MortonPoint* end, unsigned int level, unsigned int parallelLevels, vector<Point>& misfits)
+{
+  if(static_cast<size_t>(end - begin) <= capacity || level == MORTON_LEVELS)
+  {
+    // a leaf past capacity here is split by the next Insert, as usual
+    xs.reserve(end - begin);
+    ys.reserve(end - begin);
+    ids.reserve(end - begin);
+    for(const MortonPoint* m = begin; m != end; ++m)
+    {
+      if(boundary.Contains(m->P))
+      {
+        xs.push_back(static_cast<Coord>(m->P.X));
+        ys.push_back(static_cast<Coord>(m->P.Y));
+        ids.push_back(m->P.ID);
+      }
+      else
+        misfits.push_back(m->P);
+    }
+    count.store(xs.size());
+    return;
+  }
+
+  size_t childCapacity = capacity;
+  if(atPrecisionLimit())
+    childCapacity = std::numeric_limits<size_t>::max();
+  BasicLockQuadtree* children[4];
+  for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+    children[quadrant] = new BasicLockQuadtree(boundary.Quadrant(quadrant), childCapacity);
+
+  const MortonPoint* ends[4];
+  MortonSplit(begin, end, level, ends);
+  const MortonPoint* begins[4] = {begin, ends[0], ends[1], ends[2]};
+  if(level < parallelLevels)
+  {
+    vector<Point> childMisfits[4];
+    vector<std::thread> workers;
+    for(unsigned int quadrant = 1; quadrant != 4; ++quadrant)
+    {
+      workers.push_back(std::thread([&, quadrant] () {
+        children[quadrant]->build(begins[quadrant], ends[quadrant], level + 1, parallelLevels, childMisfits[quadrant]);
+      }));
+    }
+    children[0]->build(begins[0], ends[0], level + 1, parallelLevels, childMisfits[0]);
+    for(auto& w : workers)
+      w.join();
+    for(const auto& m : childMisfits)
+      misfits.insert(misfits.end(), m.begin(), m.end());
+  }
+  else
+  {
+    for(unsigned int quadrant = 0; quadrant != 4; ++quadrant)
+      children[quadrant]->build(begins[quadrant], ends[quadrant], level + 1, parallelLevels, misfits);
+  }
+
+  Nw = children[0];
+  Ne = children[1];
+  Sw = children[2];
+  Se = children[3];
+  count.store(Nw->count.load() + Ne->count.load() + Sw->count.load() + Se->count.load());
   capacity = 0;
 }
 
-void LockQuadtree::disperse()
+/// A subtree a circle or polygon wholly contains is walked as a query of its own boundary, which tests none of its points.
+/// A box already skips the tests in such a subtree's leaves.
+template <typename Coord, size_t FixedCapacity>
+template <typename Region, typename Emit>
+void BasicLockQuadtree<Coord, FixedCapacity>::query(const Region& r, Emit& emit)
 {
-  for(auto i = points.begin(), end = points.end(); i != end; ++i)
+  if(!r.Intersects(boundary))
+    return;
+  if(!std::is_same<Region, BoundingBox>::value && r.Contains(boundary))
   {
-    Point p = *i;
-    const bool ok = Nw->Insert(p) || Ne->Insert(p) || Sw->Insert(p) || Se->Insert(p);
-    if(!ok)
-      cout << "disperse insert failed.";
+    query(boundary, emit);
+    return;
   }
-  points.clear();
+
+  // held while the children are walked, so a Move can't take a point from a part of the subtree not yet read to one already read
+  SharedLock lock(pointsMutex);
+  filter::ForEachInside(xs.data(), ys.data(), ids.data(), xs.size(), r, boundary, emit);
+  if(Nw == nullptr)
+    return;
+  for(BasicLockQuadtree* child : {Nw, Ne, Sw, Se})
+    child->query(r, emit);
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::Query(const BoundingBox& b, vector<Point>& found)
+{
+  Guard pin(Reclamation::Epoch);
+  const auto emit = [&found] (const Point& p) {found.push_back(p);};
+  query(b, emit);
 }
 
-vector<Point> LockQuadtree::Query(const BoundingBox& b)
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::Query(const Circle& c, vector<Point>& found)
 {
-  pointsMutex.lock();
-  vector<Point> found;
+  Guard pin(Reclamation::Epoch);
+  const auto emit = [&found] (const Point& p) {found.push_back(p);};
+  query(c, emit);
+}
 
-  if(!boundary.Intersects(b))
-    return found;
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::Query(const ConvexPolygon& c, vector<Point>& found)
+{
+  Guard pin(Reclamation::Epoch);
+  const auto emit = [&found] (const Point& p) {found.push_back(p);};
+  query(c, emit);
+}
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::QueryIDs(const BoundingBox& b, vector<uint64_t>& found)
+{
+  Guard pin(Reclamation::Epoch);
+  const auto emit = [&found] (const Point& p) {found.push_back(p.ID);};
+  query(b, emit);
+}
 
-  for(auto i = points.begin(), end = points.end(); i != end; ++i)
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::QueryBatch(const vector<BoundingBox>& boxes, vector<vector<Point>>& found)
+{
+  Guard pin(Reclamation::Epoch);
+  found.resize(boxes.size());
+  // the active boxes, a stack of one slice per level. Kept per thread so a batch allocates nothing once it has run a few times.
+  thread_local vector<uint32_t> active;
+  active.clear();
+  for(size_t i = 0; i != boxes.size(); ++i)
   {
-    if(b.Contains(*i))
-      found.push_back(*i);
+    if(boundary.Intersects(boxes[i]))
+      active.push_back(static_cast<uint32_t>(i));
   }
-  pointsMutex.unlock();
+  if(!active.empty())
+    queryBatch(boxes, found, active, 0);
+}
 
-  if(Nw != nullptr)
+/// query, for every active box at once, taking each node's lock once for the lot and holding it while the children are walked
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::queryBatch(const vector<BoundingBox>& boxes, vector<vector<Point>>& found, vector<uint32_t>& active, size_t begin)
+{
+  const size_t end = active.size();
+  SharedLock lock(pointsMutex);
+  for(size_t i = begin; i != end; ++i)
+  {
+    vector<Point>& out = found[active[i]];
+    const auto emit = [&out] (const Point& p) {out.push_back(p);};
+    filter::ForEachContained(xs.data(), ys.data(), ids.data(), xs.size(), boxes[active[i]], boundary, emit);
+  }
+  if(Nw == nullptr)
+    return;
+
+  for(BasicLockQuadtree* child : {Nw, Ne, Sw, Se})
+  {
+    for(size_t i = begin; i != end; ++i)
+    {
+      if(child->boundary.Intersects(boxes[active[i]]))
+        active.push_back(active[i]);
+    }
+    if(active.size() != end)
+      child->queryBatch(boxes, found, active, end);
+    active.resize(end);
+  }
+}
+
+/// The caller's pin lasts the whole Run, so no node a worker reaches is freed by a merge until it's done.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::ParallelQuery(const BoundingBox& b, vector<Point>& found, TaskPool& pool, size_t grain)
+{
+  Guard pin(Reclamation::Epoch);
+  vector<vector<Point>> buffers(pool.Size());
+  pool.Run([&] (unsigned int worker) {parallelQuery(b, pool, grain, buffers, worker);});
+  size_t total = found.size();
+  for(const auto& buffer : buffers)
+    total += buffer.size();
+  found.reserve(total);
+  for(const auto& buffer : buffers)
+    found.insert(found.end(), buffer.begin(), buffer.end());
+}
+
+/// Like query, a node's children are read under its lock and walked without it; a merge leaves them intact until the pin ends.
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::parallelQuery(const BoundingBox& b, TaskPool& pool, size_t grain, vector<vector<Point>>& buffers, unsigned int worker)
+{
+  if(!boundary.Intersects(b))
+    return;
+
+  BasicLockQuadtree* children[4];
+  unsigned int n = 0;
+  bool split;
   {
-    vector<Point> f = Nw->Query(b);
-    found.insert(found.end(), f.begin(), f.end());
+    SharedLock lock(pointsMutex);
+    split = Nw != nullptr && count.load() > grain;
+    if(split)
+    {
+      for(BasicLockQuadtree* c : {Nw, Ne, Sw, Se})
+      {
+        if(c->boundary.Intersects(b))
+          children[n++] = c;
+      }
+    }
   }
-  if(Ne != nullptr)
+  if(!split)
   {
-    vector<Point> f = Ne->Query(b);
-    found.insert(found.end(), f.begin(), f.end());
+    vector<Point>& found = buffers[worker];
+    const auto emit = [&found] (const Point& p) {found.push_back(p);};
+    query(b, emit);
+    return;
   }
-  if(Sw != nullptr)
+
+  for(unsigned int i = 0; i + 1 < n; ++i)
   {
-    vector<Point> f = Sw->Query(b);
-    found.insert(found.end(), f.begin(), f.end());
+    BasicLockQuadtree* c = children[i];
+    pool.Spawn(worker, [c, b, grain, &pool, &buffers] (unsigned int w) {c->parallelQuery(b, pool, grain, buffers, w);});
   }
-  if(Se != nullptr)
+  if(n != 0)
+    children[n - 1]->parallelQuery(b, pool, grain, buffers, worker);
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockQuadtree<Coord, FixedCapacity>::Count(const BoundingBox& b)
+{
+  Guard pin(Reclamation::Epoch);
+  return tally(b);
+}
+
+template <typename Coord, size_t FixedCapacity>
+size_t BasicLockQuadtree<Coord, FixedCapacity>::tally(const BoundingBox& b)
+{
+  if(!boundary.Intersects(b))
+    return 0;
+  if(b.Contains(boundary))
+    return count.load();
+
+  size_t n = 0;
+  const auto tally = [&n] (const Point&) {++n;};
+  // held while the children are counted, as query holds it
+  SharedLock lock(pointsMutex);
+  filter::ForEachContained(xs.data(), ys.data(), ids.data(), xs.size(), b, boundary, tally);
+  if(Nw == nullptr)
+    return n;
+  for(BasicLockQuadtree* child : {Nw, Ne, Sw, Se})
+    n += child->tally(b);
+  return n;
+}
+
+template <typename Coord, size_t FixedCapacity>
+vector<Point> BasicLockQuadtree<Coord, FixedCapacity>::Nearest(const Point& p, size_t k)
+{
+  Guard pin(Reclamation::Epoch);
+  NearestPoints best(p, k);
+  if(k == 0)
+    return best.Take();
+  NearestQueue<BasicLockQuadtree> queue;
+  queue.push({DistanceSquared(p, boundary), this});
+  while(!queue.empty() && queue.top().Distance < best.Worst())
   {
-    vector<Point> f = Se->Query(b);
-    found.insert(found.end(), f.begin(), f.end());
+    BasicLockQuadtree* node = queue.top().N;
+    queue.pop();
+    BasicLockQuadtree* children[4];
+    {
+      // subdivide() moves points down under the exclusive lock, so this sees each point in exactly one node.
+      // A merge copies them up, but this never goes back to a node once it has queued the children.
+      SharedLock lock(node->pointsMutex);
+      for(size_t i = 0, end = node->xs.size(); i != end; ++i)
+        best.Offer(node->xs[i], node->ys[i], node->ids[i]);
+      children[0] = node->Nw;
+      children[1] = node->Ne;
+      children[2] = node->Sw;
+      children[3] = node->Se;
+    }
+    for(BasicLockQuadtree* child : children)
+    {
+      if(child != nullptr)
+        queue.push({DistanceSquared(p, child->boundary), child});
+    }
   }
-  return found;
+  return best.Take();
+}
+
+template <typename Coord, size_t FixedCapacity>
+std::unique_ptr<Snapshot> BasicLockQuadtree<Coord, FixedCapacity>::Freeze()
+{
+  return Snapshot::Build(Query(boundary), boundary, leafCapacity);
 }
+
+template <typename Coord, size_t FixedCapacity>
+void BasicLockQuadtree<Coord, FixedCapacity>::Query(const BoundingBox& b, const PointVisitor& visit)
+{
+  Guard pin(Reclamation::Epoch);
+  query(b, visit);
+}
+
+template class BasicLockQuadtree<double, 0>;
+template class BasicLockQuadtree<float, 0>;
+template class BasicLockQuadtree<double, 16>;
+template class BasicLockQuadtree<float, 16>;
+template class BasicLockQuadtree<int32_t, 0>;
+template class BasicLockQuadtree<int32_t, 16>;
 }
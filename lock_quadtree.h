@@ -3,46 +3,141 @@
 
 #include <vector>
 #include <mutex>
-//#include <memory>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <cmath>
 #include "quadtree.h"
+#include "morton.h"
+#include "nearest.h"
+#include "snapshot.h"
+#include "reclaim.h"
+#include "tasks.h"
+#include "small_vector.h"
 
 
 namespace quadtree 
 {
-class LockQuadtree : public Quadtree
+/// A tree with a reader-writer lock per node, whose leaves store coordinates as Coord, double, float or int32_t, and split
+/// past FixedCapacity points. FixedCapacity 0 means the constructor's capacity is used instead; otherwise a leaf keeps that many
+/// points inline in the node, and only goes to the heap for more. Points are rounded to Coord, and an integer tree covers
+/// IntegerBoundary() and picks children by bits, as BasicLockfreeQuadtree does.
+/// Its fanout is fixed at four, as BasicLockfreeQuadtree's is.
+/// LockQuadtree is the double, runtime-capacity instantiation; lock_quadtree.cpp compiles the ones listed below it.
+template <typename Coord = double, size_t FixedCapacity = 0>
+class BasicLockQuadtree final : public Quadtree
 {
 public:
   // @todo create destructor, that deletes all the newed children
-  LockQuadtree(BoundingBox boundary, size_t capacity);
-  virtual ~LockQuadtree() {}
+  BasicLockQuadtree(BoundingBox boundary, size_t capacity);
+  virtual ~BasicLockQuadtree() {}
 
   virtual bool               Insert(const Point& p);
-  virtual std::vector<Point> Query(const BoundingBox&);
+  virtual bool               Delete(const Point& p);
+  virtual size_t             Delete(const BoundingBox& b);
+  /// Only the lowest node holding both positions is locked exclusively. Within one leaf the point's coordinates are
+  /// overwritten in place; otherwise it's deleted from one child and inserted into another, below that node.
+  /// Query, Count and QueryBatch find it at one position or the other, never both or neither.
+  /// ParallelQuery and Nearest don't hold a node while they walk below it, so they may.
+  virtual bool               Move(const Point& from, const Point& to);
+  virtual void               Query(const BoundingBox&, std::vector<Point>& found);
+  virtual void               Query(const BoundingBox&, const PointVisitor& visit);
+  virtual void               Query(const Circle& c, std::vector<Point>& found);
+  virtual void               Query(const ConvexPolygon& c, std::vector<Point>& found);
+  using Quadtree::Query;
+  virtual void               QueryIDs(const BoundingBox&, std::vector<uint64_t>& found);
+  virtual void               QueryBatch(const std::vector<BoundingBox>& boxes, std::vector<std::vector<Point>>& found);
+  virtual size_t             Count(const BoundingBox&);
+  virtual std::vector<Point> Nearest(const Point& p, size_t k);
   virtual BoundingBox        Boundary() {return boundary;}
+  /// Query, split across pool's workers: each node with children and more than grain points hands them out as separate tasks.
+  /// The points come in no particular order.
+  void ParallelQuery(const BoundingBox& b, std::vector<Point>& found, TaskPool& pool, size_t grain = 4096);
+  /// @return a read-only, pointerless copy of the points a query of the whole boundary finds, with leaves of this tree's capacity.
+  /// Safe to call alongside anything else.
+  std::unique_ptr<Snapshot> Freeze();
   bool ThreadCanComplete(); ///< @todo not sure I like this. Make gc() call until success on each func?
 
+  /// Builds a tree from a batch of points at once, from a parallel Morton sort. Points outside boundary are dropped.
+  /// @param threads 0 for one per hardware thread
+  static std::unique_ptr<BasicLockQuadtree> BulkLoad(const std::vector<Point>& points, BoundingBox boundary, size_t capacity, unsigned int threads = 0);
+
   BoundingBox boundary; ///< @todo change to shared_ptr ?
 
   // @todo rename these and vars, swap case
   // this are here so the gui can get their boundaries.
-  LockQuadtree* nw() {return Nw;}
-  LockQuadtree* ne() {return Ne;}
-  LockQuadtree* sw() {return Sw;}
-  LockQuadtree* se() {return Se;}
+  BasicLockQuadtree* nw() {return Nw;}
+  BasicLockQuadtree* ne() {return Ne;}
+  BasicLockQuadtree* sw() {return Sw;}
+  BasicLockQuadtree* se() {return Se;}
 
 private:
-  LockQuadtree();
+  BasicLockQuadtree();
+
+  /// a leaf's coordinates or IDs: on the heap, or, with a FixedCapacity, inline up to it
+  template <typename T>
+  using Leaf = typename std::conditional<FixedCapacity == 0, std::vector<T>, SmallVector<T, FixedCapacity>>::type;
+  typedef Leaf<Coord> Coords;
+  /// @return p as it's stored, rounded to Coord
+  static Point stored(const Point& p)
+  {
+    return RoundedTo<Coord>(p);
+  }
 
-  std::mutex pointsMutex;
-  std::vector<Point> points;
+  typedef std::shared_lock<std::shared_mutex> SharedLock;
+  typedef std::unique_lock<std::shared_mutex> UniqueLock;
+
+  /// guards the points, capacity and the children. Shared for reading, exclusive for changing.
+  std::shared_mutex pointsMutex;
+  /// the leaf's points, coordinates and IDs in separate arrays so queries can filter several at once
+  Coords xs;
+  Coords ys;
+  Leaf<uint64_t> ids;
   size_t capacity;
-  LockQuadtree* Nw;
-  LockQuadtree* Ne;
-  LockQuadtree* Sw;
-  LockQuadtree* Se;
+  /// capacity as a leaf; capacity itself is 0 while this has children
+  const size_t leafCapacity;
+  BasicLockQuadtree* Nw;
+  BasicLockQuadtree* Ne;
+  BasicLockQuadtree* Sw;
+  BasicLockQuadtree* Se;
+  /// points in this subtree. Bumped on the way down, under a shared lock, so it's atomic, and taken back if the insert fails.
+  std::atomic<size_t> count;
+  /// integer trees only: the IntegerLevels() of the boundary
+  const unsigned int levels;
 
+  /// @return the child p belongs in, or nullptr if none contains it
+  BasicLockQuadtree* child(const Point& p);
+  /// @return the child holding both from and to, or nullptr if they're in different children, or this is a leaf
+  BasicLockQuadtree* holding(const Point& from, const Point& to);
+  /// the children can't split any further
+  bool atPrecisionLimit() const;
   void subdivide();
   void disperse();
+  /// the caller holds a shared lock on the parent, so this can't be merged away underneath it
+  bool erase(const Point& p);
+  size_t erase(const BoundingBox& b);
+  /// folds the children back into this node if they're leaves holding few enough points between them.
+  /// The caller holds a shared lock on the parent, and no lock on this.
+  void merge();
+  size_t tally(const BoundingBox& b);
+  /// answers the boxes active[begin, end()) for this subtree. Children push their own boxes past end(), and pop them.
+  void queryBatch(const std::vector<BoundingBox>& boxes, std::vector<std::vector<Point>>& found, std::vector<uint32_t>& active, size_t begin);
+  void parallelQuery(const BoundingBox& b, TaskPool& pool, size_t grain, std::vector<std::vector<Point>>& buffers, unsigned int worker);
+  /// turns this unpublished leaf into the subtree for the sorted points [begin, end)
+  /// @param misfits gets the points that rounding put in a leaf whose boundary doesn't contain them
+  void build(const MortonPoint* begin, const MortonPoint* end, unsigned int level, unsigned int parallelLevels, std::vector<Point>& misfits);
+  /// the query traversal, for a BoundingBox, Circle or ConvexPolygon; emit is called with each point found
+  template <typename Region, typename Emit>
+  void query(const Region& r, Emit& emit);
 };
+
+typedef BasicLockQuadtree<double, 0> LockQuadtree;
+extern template class BasicLockQuadtree<double, 0>;
+extern template class BasicLockQuadtree<float, 0>;
+extern template class BasicLockQuadtree<double, 16>;
+extern template class BasicLockQuadtree<float, 16>;
+extern template class BasicLockQuadtree<int32_t, 0>;
+extern template class BasicLockQuadtree<int32_t, 16>;
 }
 #endif // quadtreeH
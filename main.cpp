@@ -3,10 +3,18 @@
 #include "quadtree.h"
 #include "free_quadtree.h"
 #include "lock_quadtree.h"
+#include "snapshot.h"
+#include "tasks.h"
+#include "stats.h"
 #include <atomic>
 #include <memory>
 #include <thread>
 #include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <malloc.h>
 
 namespace
 {
@@ -16,8 +24,6 @@ using std::endl;
 using std::atomic;
 using std::thread;
 using std::shared_ptr;
-using std::srand;
-using std::time;
 using std::max;
 using std::strtoul;
 using std::chrono::duration_cast;
@@ -26,17 +32,29 @@ using std::chrono::high_resolution_clock;
 using std::chrono::duration;
 using quadtree::BoundingBox;
 using quadtree::Point;
+using quadtree::Coordinates;
+using quadtree::Circle;
+using quadtree::ConvexPolygon;
 using quadtree::Quadtree;
 using quadtree::LockfreeQuadtree;
 using quadtree::LockQuadtree;
+using quadtree::BasicLockfreeQuadtree;
+using quadtree::BasicLockQuadtree;
+using quadtree::Allocation;
+using quadtree::Reclamation;
+using quadtree::Snapshot;
+using quadtree::TaskPool;
+using quadtree::Consistency;
 
 const unsigned int DEFAULT_CAPACITY = 4;
 const unsigned int DEFAULT_THREADS = max(thread::hardware_concurrency(), 1u);
 const unsigned int DEFAULT_POINTS = 10000000;
 
+/// each thread has its own generator; rand() is shared, and serializes the inserting threads
 inline double frand()
 {
-  return (double)rand() / (double)RAND_MAX;
+  thread_local std::minstd_rand rng(std::random_device{}());
+  return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
 }
 }
 
@@ -56,6 +74,7 @@ int testInsert(Quadtree* q, int points, int numThreads)
       if(!ok)
 	cout << "testInsert insert failed" << endl;
     }
+    q->Flush();
   };
 
 
@@ -129,15 +148,36 @@ void printTree(Quadtree* q)
 {
   const BoundingBox b = {{100.0, 100.0}, {25.0, 25.0}};
 
-  const time_point<high_resolution_clock> start = high_resolution_clock::now();
+  time_point<high_resolution_clock> start = high_resolution_clock::now();
 //  vector<Point> ps = q->Query(q->Boundary());
   vector<Point> ps = q->Query(b);
 
-  const time_point<high_resolution_clock> end = high_resolution_clock::now();
-  const duration<double> elapsed = duration_cast<duration<double>>(end - start);
+  time_point<high_resolution_clock> end = high_resolution_clock::now();
+  duration<double> elapsed = duration_cast<duration<double>>(end - start);
 
   cout << "queried " << ps.size() << " in " << elapsed.count() << " seconds." << endl;
 
+  // again into the same buffer, so it's already big enough
+  ps.clear();
+  start = high_resolution_clock::now();
+  q->Query(b, ps);
+  end = high_resolution_clock::now();
+  elapsed = duration_cast<duration<double>>(end - start);
+  cout << "queried " << ps.size() << " into a reused buffer in " << elapsed.count() << " seconds." << endl;
+
+  size_t visited = 0;
+  start = high_resolution_clock::now();
+  q->Query(b, [&visited] (const Point&) {++visited;});
+  end = high_resolution_clock::now();
+  elapsed = duration_cast<duration<double>>(end - start);
+  cout << "visited " << visited << " in " << elapsed.count() << " seconds." << endl;
+
+  start = high_resolution_clock::now();
+  const size_t counted = q->Count(b);
+  end = high_resolution_clock::now();
+  elapsed = duration_cast<duration<double>>(end - start);
+  cout << "counted " << counted << " in " << elapsed.count() << " seconds." << endl;
+
   if(ps.size() < 1000)
   {
     cout << "found ";
@@ -147,8 +187,763 @@ void printTree(Quadtree* q)
   }
 }
 
+/// inserts points with 1, 2, 4 ... maxThreads threads, under each reclamation scheme, and prints the rate of each
+void sweepReclamation(int points, unsigned int maxThreads, size_t capacity)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  cout << "threads,hazard pointer inserts/s,epoch inserts/s" << endl;
+  for(unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    cout << threads;
+    for(const Reclamation r : {Reclamation::HazardPointer, Reclamation::Epoch})
+    {
+      LockfreeQuadtree q(b, capacity, Allocation::Heap, r);
+      std::streambuf* out = cout.rdbuf(nullptr); // testInsert talks
+      const time_point<high_resolution_clock> start = high_resolution_clock::now();
+      const int inserted = testInsert(&q, points, threads);
+      const time_point<high_resolution_clock> end = high_resolution_clock::now();
+      cout.rdbuf(out);
+      const duration<double> elapsed = duration_cast<duration<double>>(end - start);
+      cout << "," << inserted / elapsed.count();
+    }
+    cout << endl;
+  }
+}
+
+/// @return seconds taken by f
+template <typename F>
+double timed(F f)
+{
+  const time_point<high_resolution_clock> start = high_resolution_clock::now();
+  f();
+  const time_point<high_resolution_clock> end = high_resolution_clock::now();
+  return duration_cast<duration<double>>(end - start).count();
+}
+
+/// builds each tree from the same points, by concurrent inserts and by BulkLoad, and prints the time each takes
+void compareBulkLoad(int points, unsigned int threads, size_t capacity)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  vector<Point> ps;
+  ps.reserve(points);
+  for(int i = 0; i != points; ++i)
+    ps.push_back(Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0));
+
+  /// inserts ps with threads threads
+  const auto insertAll = [&ps, threads] (Quadtree* q) {
+    vector<thread> workers;
+    for(unsigned int t = 0; t != threads; ++t)
+    {
+      workers.push_back(thread([&ps, q, t, threads] () {
+        for(size_t i = ps.size() * t / threads, end = ps.size() * (t + 1) / threads; i != end; ++i)
+          q->Insert(ps[i]);
+      }));
+    }
+    for(auto& w : workers)
+      w.join();
+  };
+
+  cout << "tree,build,seconds,points/s,found" << endl;
+  const auto report = [points, &b] (const char* tree, const char* build, double seconds, Quadtree* q) {
+    cout << tree << "," << build << "," << seconds << "," << points / seconds << "," << q->Query(b).size() << endl;
+  };
+
+  {
+    LockfreeQuadtree q(b, capacity);
+    report("lockfree", "insert", timed([&] () {insertAll(&q);}), &q);
+  }
+  {
+    std::unique_ptr<LockfreeQuadtree> q;
+    const double seconds = timed([&] () {q = LockfreeQuadtree::BulkLoad(ps, b, capacity, Allocation::Heap, Reclamation::HazardPointer, threads);});
+    report("lockfree", "bulk", seconds, q.get());
+  }
+  {
+    LockQuadtree q(b, capacity);
+    report("lock", "insert", timed([&] () {insertAll(&q);}), &q);
+  }
+  {
+    std::unique_ptr<LockQuadtree> q;
+    const double seconds = timed([&] () {q = LockQuadtree::BulkLoad(ps, b, capacity, threads);});
+    report("lock", "bulk", seconds, q.get());
+  }
+}
+
+/// Times a restart both ways: rebuilding the tree by inserting every point again,
+/// or freezing it once to a file and mapping that back in.
+void compareSnapshot(int points, size_t capacity, const std::string& path)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  vector<Point> ps;
+  ps.reserve(points);
+  for(int i = 0; i != points; ++i)
+    ps.push_back(Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0));
+  const BoundingBox probe = {{100, 100}, {1, 1}};
+
+  cout << "step,seconds,found" << endl;
+  std::unique_ptr<Snapshot> frozen;
+  {
+    LockfreeQuadtree q(b, capacity);
+    const double seconds = timed([&] () {
+      for(const Point& p : ps)
+        q.Insert(p);
+    });
+    cout << "insert," << seconds << "," << q.Count(probe) << endl;
+    cout << "freeze," << timed([&] () {frozen = q.Freeze();}) << "," << frozen->Count(probe) << endl;
+  }
+  bool written = false;
+  cout << "write," << timed([&] () {written = frozen->Write(path);}) << "," << frozen->Size() << endl;
+  if(!written)
+  {
+    cout << "couldn't write " << path << endl;
+    return;
+  }
+  for(const bool verify : {true, false})
+  {
+    std::unique_ptr<Snapshot> mapped;
+    const double seconds = timed([&] () {mapped = Snapshot::Map(path, verify);});
+    if(mapped == nullptr)
+    {
+      cout << "couldn't map " << path << endl;
+      return;
+    }
+    size_t found = 0;
+    const double first = timed([&] () {found = mapped->Count(probe);});
+    cout << (verify ? "map verified," : "map,") << seconds << "," << mapped->Size() << endl;
+    cout << "first query," << first << "," << found << endl;
+  }
+}
+
+/// Times Query against ParallelQuery on each tree, for query boxes from tiny up to the whole boundary,
+/// with pools of 1, 2, 4... up to maxThreads workers.
+/// Tiny boxes should cost about the same either way; the whole boundary is where the workers pay off.
+void sweepParallelQuery(int points, unsigned int maxThreads, size_t capacity)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  vector<Point> ps;
+  ps.reserve(points);
+  for(int i = 0; i != points; ++i)
+    ps.push_back(Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0));
+  std::unique_ptr<LockfreeQuadtree> lockfree = LockfreeQuadtree::BulkLoad(ps, b, capacity);
+  std::unique_ptr<LockQuadtree> lock = LockQuadtree::BulkLoad(ps, b, capacity);
+
+  /// @return seconds per query of each box, and the points found
+  const auto perQuery = [] (const vector<BoundingBox>& boxes, size_t& found, const std::function<void(const BoundingBox&, vector<Point>&)>& query) {
+    vector<Point> buffer;
+    found = 0;
+    const double seconds = timed([&] () {
+      for(const BoundingBox& box : boxes)
+      {
+        buffer.clear();
+        query(box, buffer);
+        found += buffer.size();
+      }
+    });
+    return seconds / boxes.size();
+  };
+
+  cout << "tree,size,threads,query seconds,parallel seconds,speedup,found" << endl;
+  for(const double size : {0.001, 0.01, 0.1, 0.5, 1.0})
+  {
+    // about the same number of points found at each size, give or take
+    const size_t queries = max(static_cast<size_t>(std::min(1000.0, 4.0 / (size * size))), static_cast<size_t>(3));
+    vector<BoundingBox> boxes;
+    for(size_t i = 0; i != queries; ++i)
+    {
+      const Point half(b.HalfDimension.X * size, b.HalfDimension.Y * size);
+      boxes.push_back({Point(b.Center.X + (frand() * 2.0 - 1.0) * (b.HalfDimension.X - half.X),
+                             b.Center.Y + (frand() * 2.0 - 1.0) * (b.HalfDimension.Y - half.Y)), half});
+    }
+    for(unsigned int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+      TaskPool pool(threads);
+      size_t found = 0;
+      size_t parallelFound = 0;
+      double serial = perQuery(boxes, found, [&] (const BoundingBox& box, vector<Point>& out) {lockfree->Query(box, out);});
+      double parallel = perQuery(boxes, parallelFound, [&] (const BoundingBox& box, vector<Point>& out) {lockfree->ParallelQuery(box, out, pool);});
+      cout << "lockfree," << size << "," << threads << "," << serial << "," << parallel << "," << serial / parallel << "," << found
+           << (found == parallelFound ? "" : " MISMATCH") << endl;
+      serial = perQuery(boxes, found, [&] (const BoundingBox& box, vector<Point>& out) {lock->Query(box, out);});
+      parallel = perQuery(boxes, parallelFound, [&] (const BoundingBox& box, vector<Point>& out) {lock->ParallelQuery(box, out, pool);});
+      cout << "lock," << size << "," << threads << "," << serial << "," << parallel << "," << serial / parallel << "," << found
+           << (found == parallelFound ? "" : " MISMATCH") << endl;
+    }
+  }
+}
+
+/// Times batches of small, viewport-sized queries on each tree, issued one by one and as one QueryBatch.
+void compareQueryBatch(int points, size_t batch, size_t capacity)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  vector<Point> ps;
+  ps.reserve(points);
+  for(int i = 0; i != points; ++i)
+    ps.push_back(Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0));
+  std::unique_ptr<Quadtree> trees[] = {
+    std::unique_ptr<Quadtree>(LockfreeQuadtree::BulkLoad(ps, b, capacity).release()),
+    std::unique_ptr<Quadtree>(LockQuadtree::BulkLoad(ps, b, capacity).release())};
+  const char* names[] = {"lockfree", "lock"};
+  const size_t rounds = max(static_cast<size_t>(100000) / batch, static_cast<size_t>(1));
+
+  cout << "tree,size,batch,queries/s one by one,queries/s batched,speedup,found" << endl;
+  for(const double size : {0.001, 0.005, 0.02})
+  {
+    vector<BoundingBox> boxes;
+    const Point half(b.HalfDimension.X * size, b.HalfDimension.Y * size);
+    for(size_t i = 0; i != batch; ++i)
+      boxes.push_back({Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0), half});
+    for(size_t t = 0; t != 2; ++t)
+    {
+      Quadtree* q = trees[t].get();
+      vector<Point> one;
+      size_t found = 0;
+      const double single = timed([&] () {
+        for(size_t round = 0; round != rounds; ++round)
+        {
+          for(const BoundingBox& box : boxes)
+          {
+            one.clear();
+            q->Query(box, one);
+            found += one.size();
+          }
+        }
+      });
+      vector<vector<Point>> results;
+      size_t batchFound = 0;
+      const double batched = timed([&] () {
+        for(size_t round = 0; round != rounds; ++round)
+        {
+          for(auto& r : results)
+            r.clear();
+          q->QueryBatch(boxes, results);
+          for(const auto& r : results)
+            batchFound += r.size();
+        }
+      });
+      const double queries = static_cast<double>(rounds * batch);
+      cout << names[t] << "," << size << "," << batch << "," << queries / single << "," << queries / batched << "," << single / batched
+           << "," << found / rounds << (found == batchFound ? "" : " MISMATCH") << endl;
+    }
+  }
+}
+
+/// Times whole-boundary queries while writers churn the tree, and prints each tree's query latency percentiles.
+/// Each writer inserts a point and deletes the one it inserted a window earlier, so leaves keep splitting and merging.
+/// The tree starts with points points; each writer adds at most its window more.
+void compareQueryLatency(int points, unsigned int writers, size_t capacity)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  const size_t window = 1000;
+  const size_t queries = 1000;
+  vector<Point> ps;
+  ps.reserve(points);
+  for(int i = 0; i != points; ++i)
+    ps.push_back(Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0));
+  std::unique_ptr<LockfreeQuadtree> restarting = LockfreeQuadtree::BulkLoad(ps, b, capacity, Allocation::Pool, Reclamation::Epoch);
+  std::unique_ptr<LockfreeQuadtree> bounded = LockfreeQuadtree::BulkLoad(ps, b, capacity, Allocation::Pool, Reclamation::Epoch);
+  bounded->QueryConsistency(Consistency::Bounded);
+  std::unique_ptr<LockQuadtree> lock = LockQuadtree::BulkLoad(ps, b, capacity);
+  Quadtree* trees[] = {restarting.get(), bounded.get(), lock.get()};
+  const char* names[] = {"lockfree restarting", "lockfree bounded", "lock"};
+
+  cout << "tree,writers,queries,p50 seconds,p99 seconds,max seconds,writes/s" << endl;
+  for(size_t t = 0; t != 3; ++t)
+  {
+    Quadtree* q = trees[t];
+    atomic<bool> done(false);
+    atomic<size_t> writes(0);
+    const auto churn = [q, &done, &writes, window] () {
+      vector<Point> recent;
+      size_t n = 0;
+      for(; !done.load(); ++n)
+      {
+        const Point p(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0);
+        if(recent.size() < window)
+          recent.push_back(p);
+        else
+        {
+          q->Delete(recent[n % window]);
+          recent[n % window] = p;
+        }
+        q->Insert(p);
+      }
+      for(const Point& p : recent)
+        q->Delete(p);
+      writes.fetch_add(n);
+    };
+    vector<thread> threads;
+    for(unsigned int i = 0; i != writers; ++i)
+      threads.push_back(thread(churn));
+
+    vector<double> latencies;
+    vector<Point> found;
+    const double seconds = timed([&] () {
+      for(size_t i = 0; i != queries; ++i)
+      {
+        found.clear();
+        latencies.push_back(timed([&] () {q->Query(b, found);}));
+      }
+    });
+    done.store(true);
+    for(thread& th : threads)
+      th.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    cout << names[t] << "," << writers << "," << queries << "," << latencies[queries / 2] << "," << latencies[queries * 99 / 100]
+         << "," << latencies.back() << "," << writes.load() / seconds << endl;
+  }
+}
+
+/// Simulates objects reporting a new position once a second, for seconds seconds: every tick threads move each object
+/// a step along its heading, then sleep out the rest of the second, while one more thread queries throughout.
+/// far percent of each tick's moves are jumps to anywhere in the boundary instead, which put the lowest node holding both
+/// positions at or near the root. The query thread times each query: small boxes, and every hundredth the whole boundary,
+/// which is what a move high in the lock-free tree restarts.
+/// Each tree moves them with Move, then with the delete and insert it stands in for.
+void compareMovingObjects(int objects, unsigned int seconds, unsigned int threads, size_t capacity, unsigned int far)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  const double speed = 0.03; // most an object covers in a tick
+  vector<Point> start;
+  vector<Point> headings;
+  vector<Point> jumps;
+  for(int i = 0; i != objects; ++i)
+  {
+    start.push_back(Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0, i));
+    const double angle = frand() * 2.0 * M_PI;
+    const double v = frand() * speed;
+    headings.push_back(Point(v * std::cos(angle), v * std::sin(angle)));
+    jumps.push_back(Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0));
+  }
+
+  cout << "tree,method,objects,far%,ms/tick,moves/s,queries/s,p99 seconds,max seconds,whole p50 seconds,whole max seconds" << endl;
+  const char* names[] = {"lockfree restarting", "lockfree bounded", "lock"};
+  for(int tree = 0; tree != 3; ++tree)
+  {
+    for(int moving = 1; moving >= 0; --moving)
+    {
+      std::unique_ptr<Quadtree> q;
+      if(tree == 2)
+        q.reset(new LockQuadtree(b, capacity));
+      else
+      {
+        LockfreeQuadtree* lockfree = new LockfreeQuadtree(b, capacity, Allocation::Pool, Reclamation::Epoch);
+        lockfree->QueryConsistency(tree == 0 ? Consistency::Restarting : Consistency::Bounded);
+        q.reset(lockfree);
+      }
+      for(const Point& p : start)
+        q->Insert(p);
+      vector<Point> at = start;
+      vector<Point> velocity = headings;
+
+      atomic<bool> done(false);
+      vector<double> latencies;
+      vector<double> wholes;
+      thread querying([&] () {
+        vector<Point> found;
+        for(size_t n = 0; !done.load(); ++n)
+        {
+          found.clear();
+          if(n % 100 == 99)
+            wholes.push_back(timed([&] () {q->Query(b, found);}));
+          else
+          {
+            const BoundingBox box = {Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0), Point(0.5, 0.5)};
+            latencies.push_back(timed([&] () {q->Query(box, found);}));
+          }
+        }
+      });
+
+      double busy = 0.0;
+      const time_point<high_resolution_clock> began = high_resolution_clock::now();
+      for(unsigned int tick = 0; tick != seconds; ++tick)
+      {
+        busy += timed([&] () {
+          vector<thread> workers;
+          for(unsigned int t = 0; t != threads; ++t)
+          {
+            workers.push_back(thread([&, t] () {
+              for(size_t i = at.size() * t / threads, end = at.size() * (t + 1) / threads; i != end; ++i)
+              {
+                Point to(at[i].X + velocity[i].X, at[i].Y + velocity[i].Y, at[i].ID);
+                if((i + tick) % 100 < far)
+                  to = Point(jumps[(i + tick) % jumps.size()], at[i].ID);
+                // turn back at the edges
+                else if(!b.Contains(to))
+                {
+                  velocity[i] = Point(-velocity[i].X, -velocity[i].Y);
+                  to = Point(at[i].X + velocity[i].X, at[i].Y + velocity[i].Y, at[i].ID);
+                }
+                if(moving ? q->Move(at[i], to) : q->Quadtree::Move(at[i], to))
+                  at[i] = to;
+              }
+            }));
+          }
+          for(thread& w : workers)
+            w.join();
+        });
+        std::this_thread::sleep_until(began + std::chrono::seconds(tick + 1));
+      }
+      done.store(true);
+      querying.join();
+      const double elapsed = duration_cast<duration<double>>(high_resolution_clock::now() - began).count();
+      std::sort(latencies.begin(), latencies.end());
+      std::sort(wholes.begin(), wholes.end());
+      if(latencies.empty())
+        latencies.push_back(0.0);
+      if(wholes.empty())
+        wholes.push_back(0.0);
+      cout << names[tree] << "," << (moving ? "move" : "delete+insert") << "," << objects << "," << far << ","
+           << busy * 1000.0 / seconds << "," << objects * seconds / busy << "," << (latencies.size() + wholes.size()) / elapsed << ","
+           << latencies[latencies.size() * 99 / 100] << "," << latencies.back() << ","
+           << wholes[wholes.size() / 2] << "," << wholes.back() << endl;
+    }
+  }
+}
+
+/// Builds tree from ps with threads threads, then queries it, calling through Tree itself so the calls can be devirtualized,
+/// then deletes every point again, and prints one row of compareInstantiations().
+/// Memory is the heap growth while building, so it counts everything the tree allocates.
+/// Undeleted is the points a delete didn't find, and should be 0: a tree that rounds points wrongly as it stores them
+/// can't find them again.
+template <typename Tree>
+void measureInstantiation(const char* tree, const char* coord, size_t fixed, const BoundingBox& b, const vector<Point>& ps,
+                          const vector<BoundingBox>& boxes, unsigned int threads, size_t capacity)
+{
+  const size_t before = mallinfo2().uordblks;
+  Tree q(b, capacity);
+  const double building = timed([&] () {
+    vector<thread> workers;
+    for(unsigned int t = 0; t != threads; ++t)
+    {
+      workers.push_back(thread([&ps, &q, t, threads] () {
+        for(size_t i = ps.size() * t / threads, end = ps.size() * (t + 1) / threads; i != end; ++i)
+          q.Insert(ps[i]);
+      }));
+    }
+    for(auto& w : workers)
+      w.join();
+  });
+  const size_t bytes = mallinfo2().uordblks - before;
+
+  vector<Point> found;
+  const double querying = timed([&] () {
+    for(const BoundingBox& box : boxes)
+      q.Query(box, found);
+  });
+
+  size_t undeleted = 0;
+  const double deleting = timed([&] () {
+    for(const Point& p : ps)
+      undeleted += !q.Delete(p);
+  });
+  cout << tree << "," << coord << "," << (fixed == 0 ? "runtime" : "fixed") << "," << static_cast<double>(bytes) / ps.size()
+       << "," << ps.size() / building << "," << boxes.size() / querying << "," << found.size()
+       << "," << ps.size() / deleting << "," << undeleted << endl;
+}
+
+/// Compares the memory and throughput of each instantiation of each tree, with the same points and query boxes.
+/// Float trees round each point as they store it, so they may find a few points more or fewer near box edges.
+void compareInstantiations(int points, unsigned int threads)
+{
+  const size_t capacity = 16; // the fixed instantiations' capacity, so every tree has the same
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  vector<Point> ps;
+  ps.reserve(points);
+  for(int i = 0; i != points; ++i)
+    ps.push_back(Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0));
+  vector<BoundingBox> boxes;
+  const Point half(0.5, 0.5);
+  for(size_t i = 0; i != 10000; ++i)
+    boxes.push_back({Point(frand() * 100.0 + 50.0, frand() * 100.0 + 50.0), half});
+
+  cout << "tree,coordinates,capacity,bytes/point,inserts/s,queries/s,found,deletes/s,undeleted" << endl;
+  measureInstantiation<BasicLockfreeQuadtree<double, 0>>("lockfree", "double", 0, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockfreeQuadtree<float, 0>>("lockfree", "float", 0, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockfreeQuadtree<double, 16>>("lockfree", "double", 16, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockfreeQuadtree<float, 16>>("lockfree", "float", 16, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockQuadtree<double, 0>>("lock", "double", 0, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockQuadtree<float, 0>>("lock", "float", 0, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockQuadtree<double, 16>>("lock", "double", 16, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockQuadtree<float, 16>>("lock", "float", 16, b, ps, boxes, threads, capacity);
+}
+
+/// Compares integer trees with double ones, on fixed-point points: whole numbers across 2^24 units on a side,
+/// a tenth of them piled on a hundred spots, as parked vehicles would be.
+void compareIntegerCoordinates(int points, unsigned int threads)
+{
+  const size_t capacity = 16;
+  const double side = 16777216.0;
+  const BoundingBox b = {{side / 2.0, side / 2.0}, {side / 2.0, side / 2.0}};
+  vector<Point> spots;
+  for(size_t i = 0; i != 100; ++i)
+    spots.push_back(Point(std::floor(frand() * side), std::floor(frand() * side)));
+  vector<Point> ps;
+  ps.reserve(points);
+  for(int i = 0; i != points; ++i)
+    ps.push_back(i % 10 == 0 ? spots[i % spots.size()] : Point(std::floor(frand() * side), std::floor(frand() * side)));
+  vector<BoundingBox> boxes;
+  const Point half(side / 200.0, side / 200.0);
+  for(size_t i = 0; i != 10000; ++i)
+    boxes.push_back({Point(std::floor(frand() * side), std::floor(frand() * side)), half});
+
+  cout << "tree,coordinates,capacity,bytes/point,inserts/s,queries/s,found,deletes/s,undeleted" << endl;
+  measureInstantiation<BasicLockfreeQuadtree<double, 0>>("lockfree", "double", 0, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockfreeQuadtree<int32_t, 0>>("lockfree", "int32", 0, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockfreeQuadtree<int32_t, 16>>("lockfree", "int32", 16, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockQuadtree<double, 0>>("lock", "double", 0, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockQuadtree<int32_t, 0>>("lock", "int32", 0, b, ps, boxes, threads, capacity);
+  measureInstantiation<BasicLockQuadtree<int32_t, 16>>("lock", "int32", 16, b, ps, boxes, threads, capacity);
+}
+
+/// the separate index callers kept before points carried IDs, keyed by coordinates
+struct CoordinateHash
+{
+  size_t operator()(const std::pair<double, double>& c) const
+  {
+    return std::hash<double>()(c.first) * 31 + std::hash<double>()(c.second);
+  }
+};
+typedef std::unordered_map<std::pair<double, double>, uint64_t, CoordinateHash> IDIndex;
+
+/// Queries the same boxes three ways: points, then each looked up in a hash map from coordinates to ID, as callers
+/// did before points carried IDs; points with their IDs; and only the IDs. Every point is distinct, so the map is unambiguous.
+template <typename Tree>
+void measurePayloads(const char* tree, const BoundingBox& b, const vector<Point>& ps, const IDIndex& index,
+                     const vector<BoundingBox>& boxes, size_t capacity)
+{
+  Tree q(b, capacity);
+  for(const Point& p : ps)
+    q.Insert(p);
+
+  vector<Point> found;
+  vector<uint64_t> ids;
+  uint64_t sum = 0; // so nothing is optimized away
+  const double mapped = timed([&] () {
+    for(const BoundingBox& box : boxes)
+    {
+      found.clear();
+      q.Query(box, found);
+      for(const Point& p : found)
+        sum += index.find(std::make_pair(p.X, p.Y))->second;
+    }
+  });
+  const double carried = timed([&] () {
+    for(const BoundingBox& box : boxes)
+    {
+      found.clear();
+      q.Query(box, found);
+      for(const Point& p : found)
+        sum += p.ID;
+    }
+  });
+  const double only = timed([&] () {
+    for(const BoundingBox& box : boxes)
+    {
+      ids.clear();
+      q.QueryIDs(box, ids);
+      for(uint64_t id : ids)
+        sum += id;
+    }
+  });
+  cout << tree << ",hash map," << boxes.size() / mapped << "," << found.size() << endl;
+  cout << tree << ",inline," << boxes.size() / carried << "," << found.size() << endl;
+  cout << tree << ",ids only," << boxes.size() / only << "," << ids.size() << endl;
+  if(sum == 0)
+    cout << "no points found" << endl;
+}
+
+void comparePayloads(int points, size_t capacity)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  vector<Point> ps;
+  IDIndex index;
+  while(ps.size() != static_cast<size_t>(points))
+  {
+    const Point p(frand() * 100 + 50, frand() * 100 + 50, ps.size());
+    if(index.emplace(std::make_pair(p.X, p.Y), p.ID).second)
+      ps.push_back(p);
+  }
+  vector<BoundingBox> boxes;
+  for(size_t i = 0; i != 10000; ++i)
+    boxes.push_back({Point(frand() * 100 + 50, frand() * 100 + 50), Point(1, 1)});
+
+  cout << "tree,ids,queries/s,found" << endl;
+  measurePayloads<LockfreeQuadtree>("lockfree", b, ps, index, boxes, capacity);
+  measurePayloads<LockQuadtree>("lock", b, ps, index, boxes, capacity);
+}
+
+/// Radius searches, each answered by querying the box around the circle and filtering what comes back, and by querying
+/// the circle itself; then the same for a convex polygon, a hexagon of the same radius.
+/// @param radius of each search; a tenth of the boundary's width, by default, so whole subtrees fall inside it
+template <typename Tree>
+void measureShapes(const char* tree, const BoundingBox& b, const vector<Point>& ps, double radius, size_t capacity)
+{
+  Tree q(b, capacity);
+  for(const Point& p : ps)
+    q.Insert(p);
+  vector<Circle> circles;
+  vector<ConvexPolygon> hexagons;
+  for(size_t i = 0; i != 1000; ++i)
+  {
+    const Coordinates center = {frand() * 100 + 50, frand() * 100 + 50};
+    circles.push_back(Circle(center, radius));
+    vector<Coordinates> corners;
+    for(int corner = 0; corner != 6; ++corner)
+      corners.push_back({center.X + radius * std::cos(corner * M_PI / 3.0), center.Y + radius * std::sin(corner * M_PI / 3.0)});
+    hexagons.push_back(ConvexPolygon(corners));
+  }
+
+  vector<Point> boxed;
+  vector<Point> found;
+  size_t filtered = 0;
+  const double filtering = timed([&] () {
+    for(const Circle& c : circles)
+    {
+      boxed.clear();
+      q.Query(c.Bounds(), boxed);
+      found.clear();
+      for(const Point& p : boxed)
+      {
+        if(c.Contains(p))
+          found.push_back(p);
+      }
+      filtered += found.size();
+    }
+  });
+  size_t exact = 0;
+  const double pruning = timed([&] () {
+    for(const Circle& c : circles)
+    {
+      found.clear();
+      q.Query(c, found);
+      exact += found.size();
+    }
+  });
+  size_t hexagonal = 0;
+  const double polygons = timed([&] () {
+    for(const ConvexPolygon& h : hexagons)
+    {
+      found.clear();
+      q.Query(h, found);
+      hexagonal += found.size();
+    }
+  });
+  cout << tree << ",box+filter," << circles.size() / filtering << "," << filtered << endl;
+  cout << tree << ",circle," << circles.size() / pruning << "," << exact << endl;
+  cout << tree << ",hexagon," << hexagons.size() / polygons << "," << hexagonal << endl;
+}
+
+void compareShapes(int points, double radius, size_t capacity)
+{
+  const BoundingBox b = {{100, 100}, {50, 50}};
+  vector<Point> ps;
+  for(int i = 0; i != points; ++i)
+    ps.push_back(Point(frand() * 100 + 50, frand() * 100 + 50, i));
+  cout << "tree,query,queries/s,found" << endl;
+  measureShapes<LockfreeQuadtree>("lockfree", b, ps, radius, capacity);
+  measureShapes<LockQuadtree>("lock", b, ps, radius, capacity);
+}
+
 int main(int argc, char** argv)
 {
+  if(argc > 1 && std::string(argv[1]) == "reclaim")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : DEFAULT_POINTS;
+    const unsigned int threads = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : DEFAULT_THREADS;
+    cout << std::fixed;
+    sweepReclamation(points, threads, DEFAULT_CAPACITY);
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "snapshot")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : DEFAULT_POINTS;
+    const unsigned int capacity = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : DEFAULT_CAPACITY;
+    const std::string path = argc > 4 ? argv[4] : "quadtree.snapshot";
+    cout << std::fixed;
+    compareSnapshot(points, max(capacity, 1u), path);
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "parallel")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : DEFAULT_POINTS;
+    const unsigned int threads = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : DEFAULT_THREADS;
+    const unsigned int capacity = argc > 4 ? static_cast<unsigned int>(strtoul(argv[4], 0, 10)) : DEFAULT_CAPACITY;
+    cout << std::fixed;
+    sweepParallelQuery(points, max(threads, 1u), max(capacity, 1u));
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "batch")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : DEFAULT_POINTS;
+    const unsigned int batch = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : 1000;
+    const unsigned int capacity = argc > 4 ? static_cast<unsigned int>(strtoul(argv[4], 0, 10)) : DEFAULT_CAPACITY;
+    cout << std::fixed;
+    compareQueryBatch(points, max(batch, 1u), max(capacity, 1u));
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "latency")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : 100000;
+    const unsigned int threads = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : DEFAULT_THREADS;
+    const unsigned int capacity = argc > 4 ? static_cast<unsigned int>(strtoul(argv[4], 0, 10)) : DEFAULT_CAPACITY;
+    cout << std::fixed;
+    compareQueryLatency(points, threads, max(capacity, 1u));
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "instantiations")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : 1000000;
+    const unsigned int threads = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : DEFAULT_THREADS;
+    cout << std::fixed;
+    compareInstantiations(points, max(threads, 1u));
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "integer")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : 1000000;
+    const unsigned int threads = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : DEFAULT_THREADS;
+    cout << std::fixed;
+    compareIntegerCoordinates(points, max(threads, 1u));
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "moving")
+  {
+    const unsigned int objects = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : 1000000;
+    const unsigned int seconds = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : 5;
+    const unsigned int threads = argc > 4 ? static_cast<unsigned int>(strtoul(argv[4], 0, 10)) : DEFAULT_THREADS;
+    const unsigned int capacity = argc > 5 ? static_cast<unsigned int>(strtoul(argv[5], 0, 10)) : DEFAULT_CAPACITY;
+    const unsigned int far = argc > 6 ? static_cast<unsigned int>(strtoul(argv[6], 0, 10)) : 1;
+    cout << std::fixed;
+    compareMovingObjects(objects, max(seconds, 1u), max(threads, 1u), max(capacity, 1u), std::min(far, 100u));
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "payloads")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : 1000000;
+    const unsigned int capacity = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : DEFAULT_CAPACITY;
+    cout << std::fixed;
+    comparePayloads(points, max(capacity, 1u));
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "shapes")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : DEFAULT_POINTS;
+    const double radius = argc > 3 ? strtod(argv[3], 0) : 10.0;
+    const unsigned int capacity = argc > 4 ? static_cast<unsigned int>(strtoul(argv[4], 0, 10)) : DEFAULT_CAPACITY;
+    cout << std::fixed;
+    compareShapes(points, radius, max(capacity, 1u));
+    return 0;
+  }
+  if(argc > 1 && std::string(argv[1]) == "bulk")
+  {
+    const unsigned int points = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], 0, 10)) : DEFAULT_POINTS;
+    const unsigned int threads = argc > 3 ? static_cast<unsigned int>(strtoul(argv[3], 0, 10)) : DEFAULT_THREADS;
+    const unsigned int capacity = argc > 4 ? static_cast<unsigned int>(strtoul(argv[4], 0, 10)) : DEFAULT_CAPACITY;
+    cout << std::fixed;
+    compareBulkLoad(points, max(threads, 1u), max(capacity, 1u));
+    return 0;
+  }
+
   // @todo cout whether unsigned long is atomic!!
 
 //  cout << sizeof(int*);
@@ -162,7 +957,18 @@ int main(int argc, char** argv)
     const auto p = static_cast<unsigned int>(strtoul(argv[1], 0, 10));
     if(p == 0)
     {
-      cout << "Usage: quadtree points threads lockfree capacity\n";
+      cout << "Usage: quadtree points threads lockfree capacity pool epoch batch\n";
+      cout << "       quadtree reclaim points maxthreads\n";
+      cout << "       quadtree bulk points threads capacity\n";
+      cout << "       quadtree snapshot points capacity file\n";
+      cout << "       quadtree parallel points maxthreads capacity\n";
+      cout << "       quadtree batch points batchsize capacity\n";
+      cout << "       quadtree latency points writers capacity\n";
+      cout << "       quadtree instantiations points threads\n";
+      cout << "       quadtree integer points threads\n";
+      cout << "       quadtree moving objects seconds threads capacity farpercent\n";
+      cout << "       quadtree payloads points capacity\n";
+      cout << "       quadtree shapes points radius capacity\n";
       return 0;
     }
     if(p > 0)
@@ -189,21 +995,49 @@ int main(int argc, char** argv)
       capacity = c;
   }
 
+  Allocation allocation = Allocation::Heap;
+  if(argc > 5)
+  {
+    const auto a = static_cast<unsigned int>(strtoul(argv[5], 0, 10));
+    if(a > 0)
+      allocation = Allocation::Pool;
+  }
+
+  Reclamation reclamation = Reclamation::HazardPointer;
+  if(argc > 6)
+  {
+    const auto e = static_cast<unsigned int>(strtoul(argv[6], 0, 10));
+    if(e > 0)
+      reclamation = Reclamation::Epoch;
+  }
+
+  // inserts each thread buffers and puts in at once; 0 for one at a time
+  size_t batch = 0;
+  if(argc > 7)
+    batch = strtoul(argv[7], 0, 10);
+
   cout << (lockfree ? "Lock Free\n" : "Lock Based\n");
 
-  srand(time(nullptr));
   cout << std::fixed;
 
   cout << "threads: " << threads << endl;
   cout << "points: " << points << endl;
   cout << "capacity: " << capacity << endl;
+  if(lockfree)
+  {
+    cout << "allocation: " << (allocation == Allocation::Pool ? "pool" : "heap") << endl;
+    cout << "reclamation: " << (reclamation == Reclamation::Epoch ? "epoch" : "hazard pointer") << endl;
+    cout << "insert batch: " << batch << endl;
+  }
 
   //#if !__has_feature(cxx_atomic)
   //  cout << "no atomic :(" << endl;
   //#endif
 
   const BoundingBox b = {{100, 100}, {50, 50}};
-  auto q = std::unique_ptr<Quadtree>(lockfree ? (Quadtree*)new LockfreeQuadtree(b, capacity) : (Quadtree*)new LockQuadtree(b, capacity));
+  auto q = std::unique_ptr<Quadtree>(lockfree ? (Quadtree*)new LockfreeQuadtree(b, capacity, allocation, reclamation) : (Quadtree*)new LockQuadtree(b, capacity));
+  if(lockfree && batch != 0)
+    static_cast<LockfreeQuadtree*>(q.get())->BufferInserts(batch);
 
   const time_point<high_resolution_clock> start = high_resolution_clock::now();
 
@@ -213,8 +1047,12 @@ int main(int argc, char** argv)
   const duration<double> elapsed = duration_cast<duration<double>>(end - start);
 
   cout << "inserted " << inserted << " in " << elapsed.count() << " seconds with " << threads << " threads." << endl;
+  cout << "inserts per second: " << inserted / elapsed.count() << endl;
 
   printTree(q.get());
 
+  if(lockfree)
+    cout << quadtree::ReadStats().String();
+
   return 0;
 }
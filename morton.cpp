@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <limits>
+#include "morton.h"
+
+namespace
+{
+using std::vector;
+using quadtree::MortonPoint;
+
+/// spreads the low 32 bits of v out to the even bits
+uint64_t spread(uint64_t v)
+{
+  v &= 0xffffffffull;
+  v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+  v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+  v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+  v = (v | (v << 2)) & 0x3333333333333333ull;
+  v = (v | (v << 1)) & 0x5555555555555555ull;
+  return v;
+}
+
+/// @return v's cell out of 2^32 across [center - half, center + half]
+uint64_t quantize(double v, double center, double half)
+{
+  const double cells = 4294967296.0;
+  const double f = (v - (center - half)) / (2.0 * half) * cells;
+  if(!(f > 0.0))
+    return 0;
+  if(f >= cells)
+    return 0xffffffffull;
+  return static_cast<uint64_t>(f);
+}
+
+/// The integers [first, last] of [lo, hi], clamped to what int32_t holds. An empty range becomes the one integer nearest it.
+void integers(double lo, double hi, int64_t& first, int64_t& last)
+{
+  const double least = std::numeric_limits<int32_t>::min();
+  const double most = std::numeric_limits<int32_t>::max();
+  first = static_cast<int64_t>(std::min(std::max(std::ceil(lo), least), most));
+  last = static_cast<int64_t>(std::min(std::max(std::floor(hi), least), most));
+  if(last < first)
+    last = first;
+}
+
+/// @return where a run of side integers starts, for the range [first, last] it covers, so it stays inside int32_t
+int64_t start(int64_t first, int64_t side)
+{
+  return std::min(first, static_cast<int64_t>(std::numeric_limits<int32_t>::max()) - side + 1);
+}
+
+bool codeLess(const MortonPoint& a, const MortonPoint& b)
+{
+  return a.Code < b.Code;
+}
+}
+
+namespace quadtree
+{
+uint64_t MortonCode(const Point& p, const BoundingBox& b)
+{
+  const uint64_t x = quantize(p.X, b.Center.X, b.HalfDimension.X);
+  const uint64_t y = quantize(p.Y, b.Center.Y, b.HalfDimension.Y);
+  return spread(x) | (spread(y) << 1);
+}
+
+vector<MortonPoint> MortonSort(const vector<Point>& points, const BoundingBox& b, unsigned int threads)
+{
+  threads = std::max(1u, std::min(threads, static_cast<unsigned int>(points.size() / 65536 + 1)));
+
+  // each thread codes and sorts its own chunk
+  vector<vector<MortonPoint>> chunks(threads);
+  vector<std::thread> workers;
+  for(unsigned int t = 0; t != threads; ++t)
+  {
+    workers.push_back(std::thread([&, t] () {
+      const size_t begin = points.size() * t / threads;
+      const size_t end = points.size() * (t + 1) / threads;
+      vector<MortonPoint>& chunk = chunks[t];
+      chunk.reserve(end - begin);
+      for(size_t i = begin; i != end; ++i)
+      {
+        if(b.Contains(points[i]))
+          chunk.push_back({MortonCode(points[i], b), points[i]});
+      }
+      std::sort(chunk.begin(), chunk.end(), codeLess);
+    }));
+  }
+  for(auto& w : workers)
+    w.join();
+  workers.clear();
+
+  // then pairs of chunks are merged in parallel, halving the number of chunks each round
+  while(chunks.size() > 1)
+  {
+    vector<vector<MortonPoint>> merged(chunks.size() / 2);
+    for(size_t i = 0; i != merged.size(); ++i)
+    {
+      workers.push_back(std::thread([&, i] () {
+        const vector<MortonPoint>& l = chunks[2 * i];
+        const vector<MortonPoint>& r = chunks[2 * i + 1];
+        merged[i].resize(l.size() + r.size(), MortonPoint{0, Point(0, 0)});
+        std::merge(l.begin(), l.end(), r.begin(), r.end(), merged[i].begin(), codeLess);
+      }));
+    }
+    for(auto& w : workers)
+      w.join();
+    workers.clear();
+    if(chunks.size() % 2 != 0)
+      merged.push_back(std::move(chunks.back()));
+    chunks.swap(merged);
+  }
+  return chunks.empty() ? vector<MortonPoint>() : std::move(chunks.front());
+}
+
+BoundingBox IntegerBoundary(const BoundingBox& b)
+{
+  int64_t west, east, north, south;
+  integers(b.Center.X - b.HalfDimension.X, b.Center.X + b.HalfDimension.X, west, east);
+  integers(b.Center.Y - b.HalfDimension.Y, b.Center.Y + b.HalfDimension.Y, north, south);
+  int64_t side = 1;
+  while(side < east - west + 1 || side < south - north + 1)
+    side *= 2;
+  west = start(west, side);
+  north = start(north, side);
+  const double half = static_cast<double>(side) / 2.0;
+  return {Point(static_cast<double>(west) - 0.5 + half, static_cast<double>(north) - 0.5 + half), Point(half, half)};
+}
+
+unsigned int IntegerLevels(const BoundingBox& b)
+{
+  return static_cast<unsigned int>(std::ilogb(2.0 * b.HalfDimension.X));
+}
+
+void MortonSplit(const MortonPoint* begin, const MortonPoint* end, unsigned int level, const MortonPoint* ends[4])
+{
+  for(unsigned int q = 0; q != 3; ++q)
+  {
+    ends[q] = std::partition_point(q == 0 ? begin : ends[q - 1], end, [level, q] (const MortonPoint& m) {
+      return MortonQuadrant(m.Code, level) <= q;
+    });
+  }
+  ends[3] = end;
+}
+}
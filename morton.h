@@ -0,0 +1,55 @@
+#ifndef mortonH
+#define mortonH
+
+#include <cstdint>
+#include <vector>
+#include "quadtree.h"
+
+namespace quadtree
+{
+/// A point and its Morton (Z-order) code within some boundary.
+/// The code interleaves 32 bits of each coordinate, y above x, so its top two bits pick the quadrant at the root,
+/// the next two the quadrant within that, and so on.
+struct MortonPoint
+{
+  uint64_t Code;
+  Point P;
+};
+
+/// levels a Morton code can tell apart
+const unsigned int MORTON_LEVELS = 32;
+
+uint64_t MortonCode(const Point& p, const BoundingBox& b);
+
+/// @return the quadrant of code at the given depth: bit 0 set for east (+X), bit 1 set for south (+Y)
+inline unsigned int MortonQuadrant(uint64_t code, unsigned int level)
+{
+  return (code >> (2 * (MORTON_LEVELS - 1 - level))) & 3;
+}
+
+/// Computes the codes of the points inside b and sorts them, using up to threads threads.
+/// Points outside b are dropped, the same as Insert would refuse them.
+std::vector<MortonPoint> MortonSort(const std::vector<Point>& points, const BoundingBox& b, unsigned int threads);
+
+/// Splits a sorted range whose codes all agree above level into its four quadrants.
+/// @param ends set to the end of each quadrant's range; quadrant q is [ends[q-1], ends[q]), starting from begin
+void MortonSplit(const MortonPoint* begin, const MortonPoint* end, unsigned int level, const MortonPoint* ends[4]);
+
+/// The box a tree of integer coordinates covers, for the boundary it was given: the integers inside b, as many of them as
+/// int32_t holds, widened to a square a power of two on a side. Its edges lie half way between integers, and so do its
+/// quadrants' all the way down, so no point is ever on an edge two nodes share.
+BoundingBox IntegerBoundary(const BoundingBox& b);
+/// @return how many times b, a box IntegerBoundary() made or one of its quadrants, splits before each quadrant holds one integer
+unsigned int IntegerLevels(const BoundingBox& b);
+
+/// @return the quadrant of the integer point p in b, a box that splits levels more times: bit levels - 1 of p's offset
+/// from b's west and north edges, the same bits MortonQuadrant() would read. levels mustn't be 0.
+inline unsigned int IntegerQuadrant(const Point& p, const BoundingBox& b, unsigned int levels)
+{
+  // the edges are half an integer short of the first point; truncating drops the half
+  const uint64_t x = static_cast<uint64_t>(p.X - (b.Center.X - b.HalfDimension.X));
+  const uint64_t y = static_cast<uint64_t>(p.Y - (b.Center.Y - b.HalfDimension.Y));
+  return static_cast<unsigned int>((x >> (levels - 1) & 1) | (y >> (levels - 1) & 1) << 1);
+}
+}
+#endif // mortonH
@@ -0,0 +1,93 @@
+#ifndef nearestH
+#define nearestH
+
+#include <vector>
+#include <queue>
+#include <limits>
+#include <algorithm>
+#include "quadtree.h"
+
+namespace quadtree
+{
+/// @return the squared distance from p to the closest point of b; 0 if b contains p
+inline double DistanceSquared(const Point& p, const BoundingBox& b)
+{
+  const double dx = std::max(std::max(b.Center.X - b.HalfDimension.X - p.X, p.X - (b.Center.X + b.HalfDimension.X)), 0.0);
+  const double dy = std::max(std::max(b.Center.Y - b.HalfDimension.Y - p.Y, p.Y - (b.Center.Y + b.HalfDimension.Y)), 0.0);
+  return dx * dx + dy * dy;
+}
+
+/// The k closest points offered so far, for a Nearest() search.
+/// Kept in a max-heap on distance, so the current worst is at the front and is the one replaced.
+class NearestPoints
+{
+public:
+  NearestPoints(const Point& target_, size_t k_)
+    : target(target_)
+    , k(k_)
+  {}
+
+  void Offer(double x, double y, uint64_t id)
+  {
+    const double dx = x - target.X;
+    const double dy = y - target.Y;
+    const Candidate c = {dx * dx + dy * dy, Point(x, y, id)};
+    if(best.size() < k)
+    {
+      best.push_back(c);
+      std::push_heap(best.begin(), best.end(), closer);
+    }
+    else if(c.Distance < best.front().Distance)
+    {
+      std::pop_heap(best.begin(), best.end(), closer);
+      best.back() = c;
+      std::push_heap(best.begin(), best.end(), closer);
+    }
+  }
+
+  /// @return the squared distance a point must beat to be kept; infinite until there are k
+  double Worst() const
+  {
+    return best.size() < k ? std::numeric_limits<double>::infinity() : best.front().Distance;
+  }
+
+  /// @return the points, nearest first. Leaves this empty.
+  std::vector<Point> Take()
+  {
+    std::sort_heap(best.begin(), best.end(), closer);
+    std::vector<Point> points;
+    points.reserve(best.size());
+    for(const Candidate& c : best)
+      points.push_back(c.P);
+    best.clear();
+    return points;
+  }
+
+private:
+  struct Candidate
+  {
+    double Distance;
+    Point P;
+  };
+  /// orders the heap farthest first
+  static bool closer(const Candidate& a, const Candidate& b) {return a.Distance < b.Distance;}
+
+  Point target;
+  size_t k;
+  std::vector<Candidate> best;
+};
+
+/// A node waiting to be searched, and how close its boundary comes to the target.
+/// The queue pops the closest first, so the search can stop at the first node farther than the k'th best point.
+template <typename Node>
+struct NearestNode
+{
+  double Distance;
+  Node* N;
+  bool operator<(const NearestNode& other) const {return Distance > other.Distance;}
+};
+
+template <typename Node>
+using NearestQueue = std::priority_queue<NearestNode<Node>>;
+}
+#endif // nearestH
@@ -0,0 +1,113 @@
+#include <cstdlib>
+#include <mutex>
+#include "pool.h"
+
+namespace
+{
+const size_t GRANULE = 16;
+const size_t MAX_SMALL = 1024; ///< anything bigger goes straight to the heap
+const size_t CLASSES = MAX_SMALL / GRANULE;
+const size_t SLAB_BYTES = 64 * 1024;
+/// Slabs and large blocks are cache-line aligned, so every object whose size is a multiple of this is too.
+const size_t ALIGN = 64;
+
+struct FreeNode
+{
+  FreeNode* Next;
+};
+
+inline size_t sizeClass(size_t bytes)
+{
+  return (bytes + GRANULE - 1) / GRANULE - 1;
+}
+
+/// free lists of exited threads, and a lock for them. Only touched on refill and thread exit.
+std::mutex depotMutex;
+FreeNode* depot[CLASSES];
+
+struct Cache
+{
+  FreeNode* Lists[CLASSES];
+  Cache()
+  {
+    for(size_t i = 0; i != CLASSES; ++i)
+      Lists[i] = nullptr;
+  }
+  ~Cache()
+  {
+    std::lock_guard<std::mutex> lock(depotMutex);
+    for(size_t i = 0; i != CLASSES; ++i)
+    {
+      while(Lists[i] != nullptr)
+      {
+        FreeNode* n = Lists[i];
+        Lists[i] = n->Next;
+        n->Next = depot[i];
+        depot[i] = n;
+      }
+    }
+  }
+};
+
+thread_local Cache cache;
+
+/// fills this thread's list for class c, from the depot if it has anything, else from a new slab
+FreeNode* refill(size_t c)
+{
+  {
+    std::lock_guard<std::mutex> lock(depotMutex);
+    if(depot[c] != nullptr)
+    {
+      FreeNode* n = depot[c];
+      depot[c] = nullptr;
+      return n;
+    }
+  }
+
+  const size_t size = (c + 1) * GRANULE;
+  char* slab = static_cast<char*>(std::aligned_alloc(ALIGN, SLAB_BYTES));
+  if(slab == nullptr)
+    throw std::bad_alloc();
+  FreeNode* head = nullptr;
+  for(size_t offset = (SLAB_BYTES / size - 1) * size; ; offset -= size)
+  {
+    FreeNode* n = reinterpret_cast<FreeNode*>(slab + offset);
+    n->Next = head;
+    head = n;
+    if(offset == 0)
+      break;
+  }
+  return head;
+}
+}
+
+namespace quadtree
+{
+namespace pool
+{
+void* Allocate(size_t bytes)
+{
+  if(bytes > MAX_SMALL)
+    return ::operator new(bytes, std::align_val_t(ALIGN));
+  const size_t c = sizeClass(bytes);
+  FreeNode* n = cache.Lists[c];
+  if(n == nullptr)
+    n = refill(c);
+  cache.Lists[c] = n->Next;
+  return n;
+}
+
+void Free(void* p, size_t bytes)
+{
+  if(bytes > MAX_SMALL)
+  {
+    ::operator delete(p, std::align_val_t(ALIGN));
+    return;
+  }
+  const size_t c = sizeClass(bytes);
+  FreeNode* n = static_cast<FreeNode*>(p);
+  n->Next = cache.Lists[c];
+  cache.Lists[c] = n;
+}
+}
+}
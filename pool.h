@@ -0,0 +1,49 @@
+#ifndef poolH
+#define poolH
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace quadtree
+{
+/// How a tree allocates its point lists and child nodes.
+/// Pool uses per-thread slabs, so the insert path doesn't go through malloc.
+enum class Allocation
+{
+  Heap,
+  Pool
+};
+
+/// Thread-local slab allocator.
+/// Freed memory goes onto the freeing thread's list, not the allocating thread's.
+/// That's what we want for the hazard pointer gc(), which frees whatever this thread retired.
+/// Slabs are never returned to the OS; a thread's free lists go back to a shared depot when it exits.
+/// Blocks whose size is a multiple of 64 are cache-line aligned.
+namespace pool
+{
+void* Allocate(size_t bytes);
+void  Free(void* p, size_t bytes);
+}
+
+template <typename T, typename... Args>
+T* Make(Allocation a, Args&&... args)
+{
+  if(a == Allocation::Heap)
+    return new T(std::forward<Args>(args)...);
+  return new (pool::Allocate(sizeof(T))) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void Destroy(Allocation a, T* p)
+{
+  if(a == Allocation::Heap)
+  {
+    delete p;
+    return;
+  }
+  p->~T();
+  pool::Free(p, sizeof(T));
+}
+}
+#endif // poolH
@@ -3,15 +3,18 @@
 
 #include <vector>
 #include <string>
+#include <functional>
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
 
 namespace quadtree 
 {
-struct Point
+/// a position or a size, without an ID. What boxes are made of.
+struct Coordinates
 {
-  Point(const double& x, const double& y)
-  : X(x)
-  , Y(y)
-  {}
   std::string String() const
   {
     return std::string() + "[" + std::to_string(X) + "," + std::to_string(Y) + "]";
@@ -21,30 +24,48 @@ struct Point
   double Y;
 };
 
-
-class PointListNode
+/// A point, and the caller's ID for whatever is there. The trees store the ID inline beside the coordinates and hand it back
+/// with the point, so a query needs no second lookup. It's part of the point's identity: Delete() removes a point only
+/// if its ID matches too, which tells duplicates apart. Points given no ID have ID 0.
+struct Point : Coordinates
 {
-public:
-  PointListNode(const Point& p, PointListNode* next) : NodePoint(p), Next(next) {}
-  Point NodePoint;
-  PointListNode* Next;
+  Point(const double& x, const double& y, uint64_t id = 0)
+  : Coordinates{x, y}
+  , ID(id)
+  {}
+  /// so a box's center can be used as a point
+  Point(const Coordinates& c, uint64_t id = 0)
+  : Coordinates(c)
+  , ID(id)
+  {}
+
+  uint64_t ID;
 };
 
-/// @todo change this to use std iterators
-class PointList
+
+/// Off for one function, for GCC 12 at -O3: its SLP vectorizer folds a double to float to double round trip into a plain
+/// copy, so a float tree stored unrounded points and could never find them again to delete.
+#if defined(__GNUC__) && !defined(__clang__)
+#define QUADTREE_NO_SLP_VECTORIZE __attribute__((optimize("no-tree-slp-vectorize")))
+#else
+#define QUADTREE_NO_SLP_VECTORIZE
+#endif
+
+/// @return p as a tree with Coord coordinates stores it: rounded to the nearest Coord, or, for an integer Coord, to the
+/// nearest whole number
+template <typename Coord>
+QUADTREE_NO_SLP_VECTORIZE Point RoundedTo(const Point& p)
 {
-public:
-  PointList(size_t capacity) : Capacity(capacity), First(nullptr), Length(0) {}
-  size_t Capacity;
-  PointListNode* First;
-  size_t Length; // cache for speed; we could calculate it in O(n) by iterating thru the nodes
-};
+  if(std::is_integral<Coord>::value)
+    return Point(std::round(p.X), std::round(p.Y), p.ID);
+  return Point(static_cast<Coord>(p.X), static_cast<Coord>(p.Y), p.ID);
+}
 
 class BoundingBox
 {
 public:
-  Point Center;
-  Point HalfDimension;
+  Coordinates Center;
+  Coordinates HalfDimension;
   bool Contains(const Point& p) const
   {
     return p.X >= Center.X - HalfDimension.X
@@ -52,6 +73,14 @@ public:
       && p.Y >= Center.Y - HalfDimension.Y
       && p.Y <= Center.Y + HalfDimension.Y;
   }
+  /// @return true if every point other contains, this contains too
+  bool Contains(const BoundingBox& other) const
+  {
+    return other.Center.X - other.HalfDimension.X >= Center.X - HalfDimension.X
+      && other.Center.X + other.HalfDimension.X <= Center.X + HalfDimension.X
+      && other.Center.Y - other.HalfDimension.Y >= Center.Y - HalfDimension.Y
+      && other.Center.Y + other.HalfDimension.Y <= Center.Y + HalfDimension.Y;
+  }
   bool Intersects(const BoundingBox& other) const
   {
     return Center.X + HalfDimension.X > other.Center.X - other.HalfDimension.X
@@ -59,19 +88,260 @@ public:
       && Center.Y + HalfDimension.Y > other.Center.Y - other.HalfDimension.Y
       && Center.Y - HalfDimension.Y < other.Center.Y + other.HalfDimension.Y;
   }
+  /// @return one quarter of this box. Bit 0 of q picks east (+X) and bit 1 picks south (+Y), the same as MortonQuadrant().
+  /// The four together contain every point this does, even where the edges don't halve exactly.
+  BoundingBox Quadrant(unsigned int q) const
+  {
+    const double west = Center.X - HalfDimension.X;
+    const double north = Center.Y - HalfDimension.Y;
+    const double east = Center.X + HalfDimension.X;
+    const double south = Center.Y + HalfDimension.Y;
+    return Covering((q & 1) ? Center.X : west, (q & 1) ? east : Center.X, (q & 2) ? Center.Y : north, (q & 2) ? south : Center.Y);
+  }
+  /// @return a box containing [west, east] by [north, south]. Its half-dimensions are nudged up until rounding leaves no edge outside.
+  static BoundingBox Covering(double west, double east, double north, double south)
+  {
+    const double up = std::numeric_limits<double>::infinity();
+    BoundingBox b = {Point((west + east) / 2.0, (north + south) / 2.0), Point((east - west) / 2.0, (south - north) / 2.0)};
+    while(b.Center.X - b.HalfDimension.X > west || b.Center.X + b.HalfDimension.X < east)
+      b.HalfDimension.X = std::nextafter(b.HalfDimension.X, up);
+    while(b.Center.Y - b.HalfDimension.Y > north || b.Center.Y + b.HalfDimension.Y < south)
+      b.HalfDimension.Y = std::nextafter(b.HalfDimension.Y, up);
+    return b;
+  }
   std::string String()
   {
     return std::string() + "[" + Center.String() + "," + HalfDimension.String() + "]";
   }
 };
 
+/// A circle to query, edge included. Tested exactly, with no slack: a node is skipped only if no point the circle
+/// contains could be in it, and taken whole only if every point in it is contained, as Contains(Point) would compute.
+class Circle
+{
+public:
+  /// @param radius no less than 0
+  Circle(const Coordinates& center, double radius)
+    : Center(center)
+    , Radius(radius)
+    , bounds(BoundingBox::Covering(center.X - radius - slack(center.X, radius), center.X + radius + slack(center.X, radius),
+                                   center.Y - radius - slack(center.Y, radius), center.Y + radius + slack(center.Y, radius)))
+  {}
+
+  bool Contains(const Point& p) const
+  {
+    const double dx = p.X - Center.X;
+    const double dy = p.Y - Center.Y;
+    return dx * dx + dy * dy <= Radius * Radius;
+  }
+  /// @return true if the circle contains every point of b. The farthest corner is tested; the rounded distance only
+  /// grows with each coordinate's distance from the center, so no point of b comes out farther.
+  bool Contains(const BoundingBox& b) const
+  {
+    const double dx = std::max(std::fabs(b.Center.X - b.HalfDimension.X - Center.X), std::fabs(b.Center.X + b.HalfDimension.X - Center.X));
+    const double dy = std::max(std::fabs(b.Center.Y - b.HalfDimension.Y - Center.Y), std::fabs(b.Center.Y + b.HalfDimension.Y - Center.Y));
+    return dx * dx + dy * dy <= Radius * Radius;
+  }
+  /// @return true if the circle may contain a point of b: if the point of b nearest the center is inside it
+  bool Intersects(const BoundingBox& b) const
+  {
+    const double x = std::min(std::max(Center.X, b.Center.X - b.HalfDimension.X), b.Center.X + b.HalfDimension.X);
+    const double y = std::min(std::max(Center.Y, b.Center.Y - b.HalfDimension.Y), b.Center.Y + b.HalfDimension.Y);
+    return Contains(Point(x, y));
+  }
+  /// @return a box containing every point the circle does
+  const BoundingBox& Bounds() const {return bounds;}
+
+  Coordinates Center;
+  double Radius;
+
+private:
+  /// widens the box by a few ulps, so a point rounding puts inside the circle is never just outside it
+  static double slack(double center, double radius)
+  {
+    return (std::fabs(center) + std::fabs(radius)) * 4.0 * std::numeric_limits<double>::epsilon();
+  }
+
+  BoundingBox bounds;
+};
+
+/// A convex polygon to query, edges included, given by its vertices in either winding. Tested as exactly as Circle:
+/// each edge's side test, as rounded, only moves one way along each axis, so one corner of a box stands for all of it.
+/// A polygon of fewer than 3 vertices, or one that isn't convex, contains what each edge's test happens to allow.
+class ConvexPolygon
+{
+public:
+  explicit ConvexPolygon(const std::vector<Coordinates>& vertices)
+    : Vertices(vertices)
+  {
+    // wound so every point inside is on the positive side() of each edge
+    double area = 0.0;
+    for(size_t i = 0, n = Vertices.size(); i != n; ++i)
+    {
+      const Coordinates& a = Vertices[i];
+      const Coordinates& b = Vertices[(i + 1) % n];
+      area += a.X * b.Y - b.X * a.Y;
+    }
+    if(area < 0.0)
+      std::reverse(Vertices.begin(), Vertices.end());
+    if(Vertices.empty())
+    {
+      // a box nothing is inside
+      const double nan = std::numeric_limits<double>::quiet_NaN();
+      bounds = {{nan, nan}, {nan, nan}};
+      return;
+    }
+    double west = Vertices[0].X;
+    double east = west;
+    double north = Vertices[0].Y;
+    double south = north;
+    for(const Coordinates& v : Vertices)
+    {
+      west = std::min(west, v.X);
+      east = std::max(east, v.X);
+      north = std::min(north, v.Y);
+      south = std::max(south, v.Y);
+    }
+    bounds = BoundingBox::Covering(west, east, north, south);
+  }
+
+  bool Contains(const Point& p) const
+  {
+    if(!bounds.Contains(p))
+      return false;
+    for(size_t i = 0, n = Vertices.size(); i != n; ++i)
+    {
+      if(side(i, p.X, p.Y) < 0.0)
+        return false;
+    }
+    return true;
+  }
+  /// @return true if the polygon contains every point of b: if, for each edge, b's corner with the least side() is inside it
+  bool Contains(const BoundingBox& b) const
+  {
+    if(Vertices.empty() || !bounds.Contains(b))
+      return false;
+    for(size_t i = 0, n = Vertices.size(); i != n; ++i)
+    {
+      if(side(i, corner(i, b, false)) < 0.0)
+        return false;
+    }
+    return true;
+  }
+  /// @return true if the polygon may contain a point of b: if b meets the polygon's box, and, for each edge, b's corner with
+  /// the greatest side() is inside it. The two are the separating axes of a convex polygon and a box.
+  bool Intersects(const BoundingBox& b) const
+  {
+    if(Vertices.empty() || !overlaps(b))
+      return false;
+    for(size_t i = 0, n = Vertices.size(); i != n; ++i)
+    {
+      if(side(i, corner(i, b, true)) < 0.0)
+        return false;
+    }
+    return true;
+  }
+  /// @return a box containing every point the polygon does
+  const BoundingBox& Bounds() const {return bounds;}
+
+  std::vector<Coordinates> Vertices;
+
+private:
+  /// @return how far (x, y) is inside edge i, from vertex i to the next, scaled by the edge's length. Negative is outside.
+  double side(size_t i, double x, double y) const
+  {
+    const Coordinates& a = Vertices[i];
+    const Coordinates& b = Vertices[(i + 1) % Vertices.size()];
+    return (b.X - a.X) * (y - a.Y) - (b.Y - a.Y) * (x - a.X);
+  }
+  double side(size_t i, const Coordinates& c) const
+  {
+    return side(i, c.X, c.Y);
+  }
+  /// @return the corner of b with the greatest side() for edge i, or the least
+  Coordinates corner(size_t i, const BoundingBox& b, bool greatest) const
+  {
+    const Coordinates& from = Vertices[i];
+    const Coordinates& to = Vertices[(i + 1) % Vertices.size()];
+    // side() grows with y when the edge runs toward +X, and with x when it runs toward -Y
+    const bool highX = (to.Y - from.Y < 0.0) == greatest;
+    const bool highY = (to.X - from.X >= 0.0) == greatest;
+    return {highX ? b.Center.X + b.HalfDimension.X : b.Center.X - b.HalfDimension.X,
+            highY ? b.Center.Y + b.HalfDimension.Y : b.Center.Y - b.HalfDimension.Y};
+  }
+  /// BoundingBox::Intersects, but touching counts, as edges are inside
+  bool overlaps(const BoundingBox& b) const
+  {
+    return bounds.Center.X + bounds.HalfDimension.X >= b.Center.X - b.HalfDimension.X
+      && bounds.Center.X - bounds.HalfDimension.X <= b.Center.X + b.HalfDimension.X
+      && bounds.Center.Y + bounds.HalfDimension.Y >= b.Center.Y - b.HalfDimension.Y
+      && bounds.Center.Y - bounds.HalfDimension.Y <= b.Center.Y + b.HalfDimension.Y;
+  }
+
+  BoundingBox bounds;
+};
+
+/// called once for each point a query finds
+typedef std::function<void(const Point&)> PointVisitor;
+
 /// interface
 class Quadtree
 {
 public:
   virtual ~Quadtree() {}
   virtual bool Insert(const Point& p) = 0;
-  virtual std::vector<Point> Query(const BoundingBox&) = 0;
+  /// makes the inserts this thread has buffered visible to everyone. Nothing to do for a tree that doesn't buffer them.
+  virtual void Flush() {}
+  /// removes one point equal to p. Subtrees left with few enough points are merged back into their parent.
+  /// @return false if there was none
+  virtual bool Delete(const Point& p) = 0;
+  /// removes every point inside the box
+  /// @return the number removed
+  virtual size_t Delete(const BoundingBox& b) = 0;
+  /// moves one point equal to from to to's coordinates. It keeps its ID; to's is ignored.
+  /// This default deletes it and inserts it again, so a query meanwhile may find it in both places or neither.
+  /// The trees override it to move it in one step.
+  /// @return false, changing nothing, if there's no such point or to is outside the boundary
+  virtual bool Move(const Point& from, const Point& to)
+  {
+    const Point moved(to.X, to.Y, from.ID);
+    return Boundary().Contains(moved) && Delete(from) && Insert(moved);
+  }
+  /// appends the points inside the box to found. Nothing is allocated per node, so found can be reused across queries.
+  virtual void Query(const BoundingBox&, std::vector<Point>& found) = 0;
+  /// calls visit once for each point inside the box
+  virtual void Query(const BoundingBox&, const PointVisitor& visit) = 0;
+  /// thin wrapper over the appending Query
+  std::vector<Point> Query(const BoundingBox& b)
+  {
+    std::vector<Point> found;
+    Query(b, found);
+    return found;
+  }
+  /// appends the points inside the circle to found. The trees prune their nodes against the circle itself, and take a
+  /// subtree it wholly contains without testing its points; this default queries the box around it and drops the corners.
+  virtual void Query(const Circle& c, std::vector<Point>& found)
+  {
+    Query(c.Bounds(), [&c, &found] (const Point& p) {if(c.Contains(p)) found.push_back(p);});
+  }
+  /// appends the points inside the polygon to found, as the circle's Query does
+  virtual void Query(const ConvexPolygon& c, std::vector<Point>& found)
+  {
+    Query(c.Bounds(), [&c, &found] (const Point& p) {if(c.Contains(p)) found.push_back(p);});
+  }
+  /// appends the IDs of the points inside the box to found, and nothing else.
+  /// The trees read them straight from their leaves; this default goes through the visiting Query.
+  virtual void QueryIDs(const BoundingBox& b, std::vector<uint64_t>& found)
+  {
+    Query(b, [&found] (const Point& p) {found.push_back(p.ID);});
+  }
+  /// Answers many queries in one walk: each node is visited once for all the boxes that reach it, not once per box.
+  /// found is resized to one vector per box, and box i's points are appended to found[i].
+  virtual void QueryBatch(const std::vector<BoundingBox>& boxes, std::vector<std::vector<Point>>& found) = 0;
+  /// @return the k points closest to p, nearest first. Fewer if the tree doesn't have k.
+  virtual std::vector<Point> Nearest(const Point& p, size_t k) = 0;
+  /// @return how many points are inside the box, without visiting the subtrees that lie wholly inside it
+  virtual size_t Count(const BoundingBox&) = 0;
   virtual BoundingBox Boundary() = 0;
 };
 }
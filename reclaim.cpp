@@ -0,0 +1,223 @@
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include "reclaim.h"
+#include "stats.h"
+
+namespace
+{
+using std::vector;
+using quadtree::Allocation;
+using quadtree::Deleter;
+using quadtree::EpochRecord;
+using quadtree::HazardPointer;
+
+/// retire() calls between attempts to advance the epoch
+const size_t EPOCH_BATCH = 64;
+
+struct Retired
+{
+  void* Ptr;
+  Deleter Del;
+  Allocation Alloc;
+  uint64_t Epoch; ///< the global epoch when this was retired. Unused by hazard pointers.
+};
+
+std::atomic<uint64_t> globalEpoch;
+
+/// retire lists of exited threads. Whoever gets the lock next frees what it can.
+std::mutex orphanMutex;
+vector<Retired> hazardOrphans;
+vector<Retired> epochOrphans;
+std::atomic<bool> haveOrphans;
+
+/// frees everything in l that no hazard pointer points to
+void scanHazards(vector<Retired>& l)
+{
+  vector<void*> hazards;
+  for(HazardPointer* head = HazardPointer::Head(); head != nullptr; head = head->Next)
+  {
+    void* p = head->Hazard.load();
+    if(p != nullptr)
+      hazards.push_back(p);
+  }
+  std::sort(hazards.begin(), hazards.end(), std::less<void*>());
+  for(auto i = l.begin(); i != l.end();)
+  {
+    if(!std::binary_search(hazards.begin(), hazards.end(), i->Ptr))
+    {
+      i->Del(i->Ptr, i->Alloc);
+      QUADTREE_COUNT(Freed);
+      i = l.erase(i);
+    }
+    else
+      ++i;
+  }
+}
+
+/// frees everything in l retired at least two epochs ago. l is in retire order, so that's a prefix.
+void scanEpochs(vector<Retired>& l)
+{
+  const uint64_t e = globalEpoch.load();
+  auto i = l.begin();
+  for(; i != l.end() && i->Epoch + 2 <= e; ++i)
+    i->Del(i->Ptr, i->Alloc);
+  QUADTREE_COUNT_N(Freed, i - l.begin());
+  l.erase(l.begin(), i);
+}
+
+/// moves the global epoch forward if every thread inside an operation has seen the current one
+void tryAdvance()
+{
+  uint64_t e = globalEpoch.load();
+  for(EpochRecord* r = EpochRecord::Head(); r != nullptr; r = r->Next)
+  {
+    const uint64_t local = r->Local.load();
+    if((local & 1) != 0 && (local >> 1) != e)
+      return;
+  }
+  globalEpoch.compare_exchange_strong(e, e + 1);
+}
+
+void collectOrphans()
+{
+  std::unique_lock<std::mutex> lock(orphanMutex, std::try_to_lock);
+  if(!lock.owns_lock())
+    return;
+  if(!hazardOrphans.empty())
+    scanHazards(hazardOrphans);
+  if(!epochOrphans.empty())
+    scanEpochs(epochOrphans);
+  haveOrphans.store(!hazardOrphans.empty() || !epochOrphans.empty());
+}
+
+struct ThreadState
+{
+  /// Each thread has a list of pointers to delete.
+  /// These are compared to the non-thread-local hazard pointer list.
+  /// If no hazard pointer contains the pointer, it is safe for deletion.
+  vector<Retired> DeleteList;
+
+  /// pointers waiting for the epoch to move on, oldest first
+  vector<Retired> Limbo;
+  EpochRecord* Record;
+  size_t Depth; ///< nested Guards
+  size_t SinceAdvance;
+
+  ThreadState() : Record(nullptr), Depth(0), SinceAdvance(0) {}
+  ~ThreadState()
+  {
+    if(Record != nullptr)
+      EpochRecord::Release(Record);
+    if(DeleteList.empty() && Limbo.empty())
+      return;
+    std::lock_guard<std::mutex> lock(orphanMutex);
+    hazardOrphans.insert(hazardOrphans.end(), DeleteList.begin(), DeleteList.end());
+    epochOrphans.insert(epochOrphans.end(), Limbo.begin(), Limbo.end());
+    haveOrphans.store(true);
+  }
+};
+
+thread_local ThreadState state;
+}
+
+namespace quadtree
+{
+std::atomic<HazardPointer*> HazardPointer::head;
+std::atomic<EpochRecord*> EpochRecord::head;
+
+HazardPointer* HazardPointer::Acquire()
+{
+  QUADTREE_COUNT(HazardAcquires);
+  // try to reuse a released HazardPointer
+  for(HazardPointer* p = head.load(); p != nullptr; p = p->Next)
+  {
+    if(p->active.test_and_set())
+      continue;
+    return p;
+  }
+  // no old released HazardPointers. Allocate a new one
+  HazardPointer* p = new HazardPointer();
+  p->active.test_and_set();
+  p->Hazard.store(nullptr);
+  /// @todo change this to a for loop. Because I like for.
+  HazardPointer* old;
+  do {
+    old = head.load();
+    p->Next = old;
+  } while(!head.compare_exchange_strong(old, p));
+  return p;
+}
+
+EpochRecord* EpochRecord::Acquire()
+{
+  for(EpochRecord* p = head.load(); p != nullptr; p = p->Next)
+  {
+    if(p->active.test_and_set())
+      continue;
+    return p;
+  }
+  EpochRecord* p = new EpochRecord();
+  p->active.test_and_set();
+  p->Local.store(0);
+  EpochRecord* old;
+  do {
+    old = head.load();
+    p->Next = old;
+  } while(!head.compare_exchange_strong(old, p));
+  return p;
+}
+
+Guard::Guard(Reclamation r)
+  : hazardPointer(nullptr)
+{
+  if(r == Reclamation::HazardPointer)
+  {
+    hazardPointer = HazardPointer::Acquire();
+    return;
+  }
+  if(state.Depth++ != 0)
+    return;
+  if(state.Record == nullptr)
+    state.Record = EpochRecord::Acquire();
+  state.Record->Local.store((globalEpoch.load() << 1) | 1);
+}
+
+Guard::~Guard()
+{
+  if(hazardPointer != nullptr)
+  {
+    HazardPointer::Release(hazardPointer);
+    return;
+  }
+  if(--state.Depth == 0)
+    state.Record->Local.store(0);
+}
+
+void Retire(Reclamation r, void* p, Deleter del, Allocation a)
+{
+  QUADTREE_COUNT(Retired);
+  if(r == Reclamation::HazardPointer)
+  {
+    state.DeleteList.push_back({p, del, a, 0});
+    scanHazards(state.DeleteList);
+    if(haveOrphans.load())
+      collectOrphans();
+    return;
+  }
+
+  state.Limbo.push_back({p, del, a, globalEpoch.load()});
+  if(++state.SinceAdvance < EPOCH_BATCH)
+    return;
+  state.SinceAdvance = 0;
+  tryAdvance();
+  scanEpochs(state.Limbo);
+  if(haveOrphans.load())
+    collectOrphans();
+}
+
+bool ThreadCanComplete()
+{
+  return state.DeleteList.empty() && state.Limbo.empty();
+}
+}
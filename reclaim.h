@@ -0,0 +1,88 @@
+#ifndef reclaimH
+#define reclaimH
+
+#include <atomic>
+#include <cstdint>
+#include "pool.h"
+
+namespace quadtree
+{
+/// How memory retired by a lock-free tree is reclaimed.
+enum class Reclamation
+{
+  HazardPointer, ///< each read publishes the pointer it's about to use. Every retire scans all published pointers.
+  Epoch          ///< each operation pins the global epoch. Retired memory is freed in batches, two epochs later.
+};
+
+/// frees an object that was allocated with the given allocation
+typedef void (*Deleter)(void* p, Allocation a);
+
+class HazardPointer
+{
+public:
+  std::atomic<void*> Hazard; // this MUST be atomic. It could be half-changed then referenced
+  HazardPointer* Next;
+private:
+  std::atomic_flag active;
+
+  static std::atomic<HazardPointer*> head;
+public:
+  static HazardPointer* Head() {return head.load();}
+  static HazardPointer* Acquire();
+  static void Release(HazardPointer* p) {p->Hazard.store(nullptr);p->active.clear();}
+};
+
+/// Per-thread registration in the epoch scheme. Acquired once per thread and cached, and reused after the thread exits.
+class EpochRecord
+{
+public:
+  /// (epoch << 1) | 1 while the thread is inside an operation, 0 otherwise
+  std::atomic<uint64_t> Local;
+  EpochRecord* Next;
+private:
+  std::atomic_flag active;
+
+  static std::atomic<EpochRecord*> head;
+public:
+  static EpochRecord* Head() {return head.load();}
+  static EpochRecord* Acquire();
+  static void Release(EpochRecord* p) {p->Local.store(0);p->active.clear();}
+};
+
+/// Protects the shared memory one thread reads during a tree operation.
+/// Under HazardPointer it holds a hazard pointer; under Epoch it pins the thread's epoch. Guards nest.
+class Guard
+{
+public:
+  explicit Guard(Reclamation r);
+  ~Guard();
+  /// @return the current value of src, which is safe to dereference until the next Protect() or Clear()
+  template <typename T>
+  T* Protect(const std::atomic<T*>& src)
+  {
+    if(hazardPointer == nullptr)
+      return src.load();
+    while(hazardPointer->Hazard.load() != src.load())
+      hazardPointer->Hazard.store(src.load());
+    return static_cast<T*>(hazardPointer->Hazard.load());
+  }
+  /// drops the protection from the last Protect()
+  void Clear()
+  {
+    if(hazardPointer != nullptr)
+      hazardPointer->Hazard.store(nullptr);
+  }
+private:
+  Guard(const Guard&);
+  Guard& operator=(const Guard&);
+
+  HazardPointer* hazardPointer;
+};
+
+/// hands p to this thread's reclaimer. It's freed with del once no reader can still hold it.
+void Retire(Reclamation r, void* p, Deleter del, Allocation a);
+
+/// @return whether there is nothing more for this thread to delete
+bool ThreadCanComplete();
+}
+#endif // reclaimH
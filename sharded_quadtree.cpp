@@ -0,0 +1,331 @@
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include "quadtree.h"
+#include "sharded_quadtree.h"
+#include "nearest.h"
+
+namespace
+{
+using std::vector;
+using std::max;
+
+using quadtree::Point;
+
+/// a point, and the share of its shard's load it stands for
+struct Weighted
+{
+  Point P;
+  double Weight;
+};
+
+/// Sorts [begin, end) by X or Y and cuts it into parts of about equal weight.
+/// @return parts + 1 edges from lo to hi. A cut lands on a point, which then belongs to the part after it.
+template <typename Coordinate>
+vector<double> cut(vector<Weighted>::iterator begin, vector<Weighted>::iterator end, unsigned int parts, double lo, double hi, Coordinate coordinate)
+{
+  std::sort(begin, end, [&coordinate] (const Weighted& a, const Weighted& b) {return coordinate(a.P) < coordinate(b.P);});
+  double total = 0.0;
+  for(auto i = begin; i != end; ++i)
+    total += i->Weight;
+
+  vector<double> edges(1, lo);
+  double sum = 0.0;
+  auto i = begin;
+  for(unsigned int part = 1; part != parts; ++part)
+  {
+    const double target = total * part / parts;
+    while(i != end && sum + i->Weight < target)
+    {
+      sum += i->Weight;
+      ++i;
+    }
+    // an empty part, or one whose points all sit on the same line, just gets no width
+    const double edge = i == end ? hi : std::min(std::max(coordinate(i->P), edges.back()), hi);
+    edges.push_back(edge);
+  }
+  edges.push_back(hi);
+  return edges;
+}
+
+/// @return the index of the part of edges holding x; an inner edge belongs to the part after it
+size_t part(vector<double>::const_iterator first, size_t parts, double x)
+{
+  return std::upper_bound(first + 1, first + parts, x) - (first + 1);
+}
+}
+
+namespace quadtree
+{
+ShardedQuadtree::ShardedQuadtree(BoundingBox boundary_, size_t capacity_, unsigned int columns_, unsigned int rows_,
+                                 Allocation allocation_, Reclamation reclamation_)
+  : boundary(boundary_)
+  , capacity(capacity_)
+  , allocation(allocation_)
+  , reclamation(reclamation_)
+  , columns(max(columns_, 1u))
+  , rows(max(rows_, 1u))
+{
+  const double west = boundary.Center.X - boundary.HalfDimension.X;
+  const double north = boundary.Center.Y - boundary.HalfDimension.Y;
+  vector<double> xs;
+  for(unsigned int c = 0; c <= columns; ++c)
+    xs.push_back(west + boundary.HalfDimension.X * 2.0 * c / columns);
+  vector<double> ys;
+  for(unsigned int c = 0; c != columns; ++c)
+  {
+    for(unsigned int r = 0; r <= rows; ++r)
+      ys.push_back(north + boundary.HalfDimension.Y * 2.0 * r / rows);
+  }
+  layout(xs, ys);
+}
+
+void ShardedQuadtree::layout(const vector<double>& columnEdges_, const vector<double>& rowEdges_)
+{
+  columnEdges = columnEdges_;
+  rowEdges = rowEdges_;
+  shards.clear();
+  for(unsigned int c = 0; c != columns; ++c)
+  {
+    const double west = columnEdges[c];
+    const double east = columnEdges[c + 1];
+    for(unsigned int r = 0; r != rows; ++r)
+    {
+      const double north = rowEdges[c * (rows + 1) + r];
+      const double south = rowEdges[c * (rows + 1) + r + 1];
+      shards.push_back(std::unique_ptr<Shard>(new Shard(BoundingBox::Covering(west, east, north, south), capacity, allocation, reclamation)));
+    }
+  }
+}
+
+size_t ShardedQuadtree::route(const Point& p) const
+{
+  if(!boundary.Contains(p))
+    return shards.size();
+  const size_t column = part(columnEdges.begin(), columns, p.X);
+  const size_t row = part(rowEdges.begin() + column * (rows + 1), rows, p.Y);
+  return column * rows + row;
+}
+
+bool ShardedQuadtree::Insert(const Point& p)
+{
+  const size_t i = route(p);
+  if(i == shards.size())
+    return false;
+  shards[i]->Operations.fetch_add(1, std::memory_order_relaxed);
+  return shards[i]->Tree.Insert(p);
+}
+
+bool ShardedQuadtree::Delete(const Point& p)
+{
+  const size_t i = route(p);
+  if(i == shards.size())
+    return false;
+  shards[i]->Operations.fetch_add(1, std::memory_order_relaxed);
+  return shards[i]->Tree.Delete(p);
+}
+
+/// Within one shard, the shard moves it. Between shards it's deleted from one and inserted into the other,
+/// so a query meanwhile may find it in both or neither.
+bool ShardedQuadtree::Move(const Point& from, const Point& to)
+{
+  const size_t i = route(from);
+  const size_t j = route(to);
+  if(i == shards.size() || j == shards.size())
+    return false;
+  if(i != j)
+    return Quadtree::Move(from, to);
+  shards[i]->Operations.fetch_add(1, std::memory_order_relaxed);
+  return shards[i]->Tree.Move(from, to);
+}
+
+size_t ShardedQuadtree::Delete(const BoundingBox& b)
+{
+  size_t n = 0;
+  for(auto& s : shards)
+  {
+    if(!s->Tree.boundary.Intersects(b))
+      continue;
+    s->Operations.fetch_add(1, std::memory_order_relaxed);
+    n += s->Tree.Delete(b);
+  }
+  return n;
+}
+
+void ShardedQuadtree::Query(const BoundingBox& b, vector<Point>& found)
+{
+  for(auto& s : shards)
+  {
+    if(!s->Tree.boundary.Intersects(b))
+      continue;
+    s->Operations.fetch_add(1, std::memory_order_relaxed);
+    s->Tree.Query(b, found);
+  }
+}
+
+void ShardedQuadtree::Query(const BoundingBox& b, const PointVisitor& visit)
+{
+  for(auto& s : shards)
+  {
+    if(!s->Tree.boundary.Intersects(b))
+      continue;
+    s->Operations.fetch_add(1, std::memory_order_relaxed);
+    s->Tree.Query(b, visit);
+  }
+}
+
+void ShardedQuadtree::Query(const Circle& c, vector<Point>& found)
+{
+  for(auto& s : shards)
+  {
+    if(!c.Intersects(s->Tree.boundary))
+      continue;
+    s->Operations.fetch_add(1, std::memory_order_relaxed);
+    s->Tree.Query(c, found);
+  }
+}
+
+void ShardedQuadtree::Query(const ConvexPolygon& c, vector<Point>& found)
+{
+  for(auto& s : shards)
+  {
+    if(!c.Intersects(s->Tree.boundary))
+      continue;
+    s->Operations.fetch_add(1, std::memory_order_relaxed);
+    s->Tree.Query(c, found);
+  }
+}
+
+void ShardedQuadtree::QueryIDs(const BoundingBox& b, vector<uint64_t>& found)
+{
+  for(auto& s : shards)
+  {
+    if(!s->Tree.boundary.Intersects(b))
+      continue;
+    s->Operations.fetch_add(1, std::memory_order_relaxed);
+    s->Tree.QueryIDs(b, found);
+  }
+}
+
+/// Every shard gets the whole batch, and drops the boxes outside it at its root.
+void ShardedQuadtree::QueryBatch(const vector<BoundingBox>& boxes, vector<vector<Point>>& found)
+{
+  found.resize(boxes.size());
+  for(auto& s : shards)
+  {
+    const size_t reaching = std::count_if(boxes.begin(), boxes.end(), [&s] (const BoundingBox& b) {return s->Tree.boundary.Intersects(b);});
+    if(reaching == 0)
+      continue;
+    s->Operations.fetch_add(reaching, std::memory_order_relaxed);
+    s->Tree.QueryBatch(boxes, found);
+  }
+}
+
+size_t ShardedQuadtree::Count(const BoundingBox& b)
+{
+  size_t n = 0;
+  for(auto& s : shards)
+  {
+    if(!s->Tree.boundary.Intersects(b))
+      continue;
+    s->Operations.fetch_add(1, std::memory_order_relaxed);
+    n += s->Tree.Count(b);
+  }
+  return n;
+}
+
+/// Asks the shards nearest first, and stops at the first one farther away than the k'th best point so far.
+vector<Point> ShardedQuadtree::Nearest(const Point& p, size_t k)
+{
+  if(k == 0)
+    return vector<Point>();
+  vector<std::pair<double, Shard*>> order;
+  order.reserve(shards.size());
+  for(auto& s : shards)
+    order.push_back(std::make_pair(DistanceSquared(p, s->Tree.boundary), s.get()));
+  std::sort(order.begin(), order.end(), [] (const std::pair<double, Shard*>& a, const std::pair<double, Shard*>& b) {return a.first < b.first;});
+
+  NearestPoints best(p, k);
+  for(const auto& o : order)
+  {
+    if(o.first > best.Worst())
+      break;
+    o.second->Operations.fetch_add(1, std::memory_order_relaxed);
+    for(const Point& found : o.second->Tree.Nearest(p, k))
+      best.Offer(found.X, found.Y, found.ID);
+  }
+  return best.Take();
+}
+
+void ShardedQuadtree::Rebalance(unsigned int threads)
+{
+  vector<Weighted> all;
+  for(auto& s : shards)
+  {
+    const vector<Point> points = s->Tree.Query(s->Tree.boundary);
+    // a shard nothing has used still weighs a little, so its points aren't all squeezed into one cell
+    const double weight = (s->Operations.load() + 1.0) / (points.size() + 1.0);
+    for(const Point& p : points)
+      all.push_back({p, weight});
+  }
+  if(all.empty())
+  {
+    for(auto& s : shards)
+      s->Operations.store(0);
+    return;
+  }
+
+  const double west = boundary.Center.X - boundary.HalfDimension.X;
+  const double east = boundary.Center.X + boundary.HalfDimension.X;
+  const double north = boundary.Center.Y - boundary.HalfDimension.Y;
+  const double south = boundary.Center.Y + boundary.HalfDimension.Y;
+  const auto x = [] (const Point& p) {return p.X;};
+  const auto y = [] (const Point& p) {return p.Y;};
+  const vector<double> xs = cut(all.begin(), all.end(), columns, west, east, x);
+  vector<double> ys;
+  auto begin = all.begin();
+  for(unsigned int c = 0; c != columns; ++c)
+  {
+    // all is sorted by X now, so each column's points are a run of it
+    auto end = c + 1 == columns ? all.end() : std::partition_point(begin, all.end(), [&xs, c] (const Weighted& w) {return w.P.X < xs[c + 1];});
+    const vector<double> column = cut(begin, end, rows, north, south, y);
+    ys.insert(ys.end(), column.begin(), column.end());
+    begin = end;
+  }
+  layout(xs, ys);
+
+  vector<vector<Point>> moving(shards.size());
+  for(const Weighted& w : all)
+    moving[route(w.P)].push_back(w.P);
+
+  if(threads == 0)
+    threads = max(std::thread::hardware_concurrency(), 1u);
+  threads = std::min(threads, static_cast<unsigned int>(shards.size()));
+  vector<std::thread> workers;
+  for(unsigned int t = 0; t != threads; ++t)
+  {
+    workers.push_back(std::thread([this, &moving, t, threads] () {
+      for(size_t i = t; i < shards.size(); i += threads)
+      {
+        for(const Point& p : moving[i])
+          shards[i]->Tree.Insert(p);
+      }
+    }));
+  }
+  for(auto& w : workers)
+    w.join();
+}
+
+double ShardedQuadtree::Imbalance() const
+{
+  size_t total = 0;
+  size_t busiest = 0;
+  for(const auto& s : shards)
+  {
+    const size_t n = s->Operations.load();
+    total += n;
+    busiest = max(busiest, n);
+  }
+  return total == 0 ? 1.0 : static_cast<double>(busiest) * shards.size() / total;
+}
+}
@@ -0,0 +1,87 @@
+#ifndef shardedquadtreeH
+#define shardedquadtreeH
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include "quadtree.h"
+#include "free_quadtree.h"
+
+namespace quadtree
+{
+/// A front end over a grid of independent lock-free trees, so inserts to different parts of the boundary never touch the
+/// same root. The boundary is cut into columns by X, and each column into rows by Y. An insert goes straight to the one
+/// shard whose cell holds it; a query only visits the shards its box intersects.
+/// Rebalance() redraws the cells from the load each shard has seen, so skewed data doesn't pile up in one shard.
+class ShardedQuadtree : public Quadtree
+{
+public:
+  /// @param columns, rows the initial grid, of equal cells. At least 1 each.
+  ShardedQuadtree(BoundingBox boundary, size_t capacity, unsigned int columns = 4, unsigned int rows = 4,
+                  Allocation allocation = Allocation::Heap, Reclamation reclamation = Reclamation::HazardPointer);
+  virtual ~ShardedQuadtree() {}
+
+  virtual bool               Insert(const Point& p);
+  virtual bool               Delete(const Point& p);
+  virtual size_t             Delete(const BoundingBox& b);
+  virtual bool               Move(const Point& from, const Point& to);
+  virtual void               Query(const BoundingBox&, std::vector<Point>& found);
+  virtual void               Query(const BoundingBox&, const PointVisitor& visit);
+  virtual void               Query(const Circle& c, std::vector<Point>& found);
+  virtual void               Query(const ConvexPolygon& c, std::vector<Point>& found);
+  using Quadtree::Query;
+  virtual void               QueryIDs(const BoundingBox&, std::vector<uint64_t>& found);
+  virtual void               QueryBatch(const std::vector<BoundingBox>& boxes, std::vector<std::vector<Point>>& found);
+  virtual size_t             Count(const BoundingBox&);
+  virtual std::vector<Point> Nearest(const Point& p, size_t k);
+  virtual BoundingBox        Boundary() {return boundary;}
+
+  /// Redraws the cells so each shard carries about the same share of the load, and moves the points to match.
+  /// A shard's load is the operations routed to it since the last rebalance, spread evenly over its points;
+  /// the columns are then cut at quantiles of that weight by X, and each column's rows by Y.
+  /// Must not run concurrently with anything else on the tree.
+  /// @param threads shards filled at once. 0 for one per hardware thread.
+  void Rebalance(unsigned int threads = 0);
+  /// @return the busiest shard's operations since the last rebalance, over the mean. 1 is perfectly even.
+  double Imbalance() const;
+
+  size_t Shards() const {return shards.size();}
+  // here so the gui and the benchmark can walk them
+  LockfreeQuadtree* shard(size_t i) {return &shards[i]->Tree;}
+
+private:
+  ShardedQuadtree(const ShardedQuadtree&);
+  ShardedQuadtree& operator=(const ShardedQuadtree&);
+
+  /// A subtree and its load, on cache lines of their own
+  struct alignas(64) Shard
+  {
+    Shard(BoundingBox boundary, size_t capacity, Allocation allocation, Reclamation reclamation)
+      : Tree(boundary, capacity, allocation, reclamation)
+      , Operations(0)
+    {}
+    LockfreeQuadtree Tree;
+    /// inserts, deletes and queries routed here since the last rebalance
+    alignas(64) std::atomic<size_t> Operations;
+  };
+
+  /// replaces the shards with empty ones for the given cell edges
+  /// @param columnEdges the X of each column's west edge, then the last one's east edge
+  /// @param rowEdges for each column in turn, the Y of each row's north edge, then the last one's south edge
+  void layout(const std::vector<double>& columnEdges, const std::vector<double>& rowEdges);
+  /// @return the index of the shard whose cell holds p, or Shards() if p is outside the boundary
+  size_t route(const Point& p) const;
+
+  BoundingBox boundary;
+  const size_t capacity;
+  const Allocation allocation;
+  const Reclamation reclamation;
+  const unsigned int columns;
+  const unsigned int rows;
+  std::vector<double> columnEdges;
+  std::vector<double> rowEdges;
+  /// column by column, each column's rows north to south
+  std::vector<std::unique_ptr<Shard>> shards;
+};
+}
+#endif // shardedquadtreeH
@@ -0,0 +1,96 @@
+#ifndef smallvectorH
+#define smallvectorH
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <iterator>
+
+namespace quadtree
+{
+/// A vector of plain values that keeps its first N inline, and only moves them to the heap past that.
+/// Just the parts of std::vector the trees use.
+template <typename T, size_t N>
+class SmallVector
+{
+  static_assert(std::is_trivially_copyable<T>::value, "SmallVector copies its elements with memcpy");
+public:
+  SmallVector()
+    : first(local)
+    , length(0)
+    , room(N)
+  {}
+  ~SmallVector()
+  {
+    if(first != local)
+      delete[] first;
+  }
+
+  T*       data() {return first;}
+  const T* data() const {return first;}
+  T*       begin() {return first;}
+  const T* begin() const {return first;}
+  T*       end() {return first + length;}
+  const T* end() const {return first + length;}
+  size_t   size() const {return length;}
+  bool     empty() const {return length == 0;}
+  T&       operator[](size_t i) {return first[i];}
+  const T& operator[](size_t i) const {return first[i];}
+  T&       back() {return first[length - 1];}
+
+  void push_back(const T& v)
+  {
+    if(length == room)
+      grow(length + 1);
+    first[length++] = v;
+  }
+  void pop_back() {--length;}
+  void clear() {length = 0;}
+  /// new elements are value-initialized, as std::vector's are
+  void resize(size_t n)
+  {
+    reserve(n);
+    std::fill(first + std::min(length, n), first + n, T());
+    length = n;
+  }
+  void reserve(size_t n)
+  {
+    if(n > room)
+      grow(n);
+  }
+  /// inserts [from, to), which mustn't be inside this, before at
+  template <typename It>
+  void insert(T* at, It from, It to)
+  {
+    const size_t offset = at - first;
+    const size_t n = std::distance(from, to);
+    reserve(length + n);
+    std::memmove(first + offset + n, first + offset, (length - offset) * sizeof(T));
+    std::copy(from, to, first + offset);
+    length += n;
+  }
+
+private:
+  SmallVector(const SmallVector&);
+  SmallVector& operator=(const SmallVector&);
+
+  /// to at least n, and at least double, so pushes are amortized constant
+  void grow(size_t n)
+  {
+    const size_t bigger = std::max(n, room * 2);
+    T* moved = new T[bigger];
+    std::memcpy(moved, first, length * sizeof(T));
+    if(first != local)
+      delete[] first;
+    first = moved;
+    room = bigger;
+  }
+
+  T* first;
+  size_t length;
+  size_t room;
+  T local[N];
+};
+}
+#endif // smallvectorH
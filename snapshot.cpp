@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "morton.h"
+#include "filter.h"
+
+namespace
+{
+using std::vector;
+using quadtree::Point;
+using quadtree::BoundingBox;
+using quadtree::SnapshotNode;
+
+/// @return the quadrant of b a live tree would put p in: the first, in Quadrant() order, that contains it
+unsigned int quadrantOf(const BoundingBox& b, const Point& p)
+{
+  for(unsigned int q = 0; q != 3; ++q)
+  {
+    if(b.Quadrant(q).Contains(p))
+      return q;
+  }
+  return 3;
+}
+
+/// The file is this header, then the nodes, then every X, then every Y, then every ID, each section starting on a 64-byte boundary.
+/// The IDs start at the first boundary after the Ys, so they need no offset of their own.
+/// Everything is in the writer's byte order; Endian lets a reader with the other order refuse the file.
+/// Nodes refer to each other and to points by index, so the file means the same wherever it's mapped.
+struct FileHeader
+{
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Endian;      ///< ENDIAN, as the writer stored it
+  uint64_t NodeCount;
+  uint64_t PointCount;
+  uint64_t NodesOffset; ///< from the start of the file
+  uint64_t XsOffset;
+  uint64_t YsOffset;
+  uint64_t Checksum;    ///< checksum() of everything after the header
+};
+
+const char MAGIC[8] = {'Q', 'T', 'S', 'N', 'A', 'P', 0, 0};
+/// bumped whenever the header, the sections or SnapshotNode change
+const uint32_t VERSION = 2;
+const uint32_t ENDIAN = 0x01020304;
+const uint64_t SECTION_ALIGN = 64;
+
+static_assert(sizeof(FileHeader) == SECTION_ALIGN, "the header fills the first section");
+static_assert(sizeof(SnapshotNode) == 56 && std::is_trivially_copyable<SnapshotNode>::value, "nodes are written as is");
+
+uint64_t aligned(uint64_t offset)
+{
+  return (offset + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN;
+}
+
+/// FNV-1a, a word at a time. Every section is a whole number of 8-byte words, padding included.
+const uint64_t CHECKSUM_BASIS = 0xcbf29ce484222325ull;
+uint64_t checksum(uint64_t h, const void* data, size_t bytes)
+{
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  for(size_t i = 0; i + 8 <= bytes; i += 8)
+  {
+    uint64_t word;
+    std::memcpy(&word, p + i, 8);
+    h = (h ^ word) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+/// @return false if any node points outside the arrays
+bool indicesValid(const SnapshotNode* nodes, uint64_t nodeCount, uint64_t pointCount)
+{
+  for(uint64_t i = 0; i != nodeCount; ++i)
+  {
+    const SnapshotNode& n = nodes[i];
+    if(n.Begin > n.End || n.End > pointCount)
+      return false;
+    // children come after their parent, so a walk can't loop
+    if(n.Children != 0 && (n.Children <= i || n.Children > nodeCount || nodeCount - n.Children < 4))
+      return false;
+  }
+  return true;
+}
+}
+
+namespace quadtree
+{
+/// The Morton sort puts the points almost in place. Each node then stably partitions its range by quadrant,
+/// which only moves the few that rounding put on the wrong side of an edge.
+std::unique_ptr<Snapshot> Snapshot::Build(const vector<Point>& points, BoundingBox boundary, size_t capacity, unsigned int threads)
+{
+  if(threads == 0)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  vector<Point> sorted;
+  {
+    const vector<MortonPoint> coded = MortonSort(points, boundary, threads);
+    sorted.reserve(coded.size());
+    for(const MortonPoint& m : coded)
+      sorted.push_back(m.P);
+  }
+
+  std::unique_ptr<Snapshot> s(new Snapshot());
+  vector<SnapshotNode>& nodes = s->nodeStore;
+  nodes.push_back({boundary, 0, sorted.size(), 0});
+  // the array is its own breadth-first queue: children are appended behind everything at their parent's depth
+  for(size_t i = 0; i != nodes.size(); ++i)
+  {
+    const BoundingBox b = nodes[i].Boundary;
+    const size_t begin = nodes[i].Begin;
+    const size_t end = nodes[i].End;
+    const double dx = 0.000001;
+    // don't subdivide further if we reach the limits of double precision
+    if(end - begin <= capacity || fabs(b.HalfDimension.X/2.0) < dx || fabs(b.HalfDimension.Y/2.0) < dx)
+      continue;
+
+    nodes[i].Children = nodes.size();
+    vector<Point>::iterator from = sorted.begin() + begin;
+    for(unsigned int q = 0; q != 4; ++q)
+    {
+      vector<Point>::iterator to = q == 3 ? sorted.begin() + end : std::stable_partition(from, sorted.begin() + end, [&b, q] (const Point& p) {
+        return quadrantOf(b, p) == q;
+      });
+      nodes.push_back({b.Quadrant(q), static_cast<uint64_t>(from - sorted.begin()), static_cast<uint64_t>(to - sorted.begin()), 0});
+      from = to;
+    }
+  }
+
+  s->xStore.reserve(sorted.size());
+  s->yStore.reserve(sorted.size());
+  s->idStore.reserve(sorted.size());
+  for(const Point& p : sorted)
+  {
+    s->xStore.push_back(p.X);
+    s->yStore.push_back(p.Y);
+    s->idStore.push_back(p.ID);
+  }
+  s->nodes = nodes.data();
+  s->xs = s->xStore.data();
+  s->ys = s->yStore.data();
+  s->ids = s->idStore.data();
+  s->nodeCount = nodes.size();
+  s->pointCount = sorted.size();
+  return s;
+}
+
+Snapshot::Snapshot()
+  : nodes(nullptr)
+  , xs(nullptr)
+  , ys(nullptr)
+  , ids(nullptr)
+  , nodeCount(0)
+  , pointCount(0)
+  , mapping(nullptr)
+  , mappingBytes(0)
+{}
+
+Snapshot::~Snapshot()
+{
+  if(mapping != nullptr)
+    munmap(mapping, mappingBytes);
+}
+
+bool Snapshot::Write(const std::string& path) const
+{
+  FileHeader header;
+  std::memcpy(header.Magic, MAGIC, sizeof(MAGIC));
+  header.Version = VERSION;
+  header.Endian = ENDIAN;
+  header.NodeCount = nodeCount;
+  header.PointCount = pointCount;
+  header.NodesOffset = SECTION_ALIGN;
+  header.XsOffset = aligned(header.NodesOffset + nodeCount * sizeof(SnapshotNode));
+  header.YsOffset = aligned(header.XsOffset + pointCount * sizeof(double));
+  const uint64_t idsOffset = aligned(header.YsOffset + pointCount * sizeof(double));
+
+  const char zeros[SECTION_ALIGN] = {};
+  const size_t nodePad = header.XsOffset - (header.NodesOffset + nodeCount * sizeof(SnapshotNode));
+  const size_t xPad = header.YsOffset - (header.XsOffset + pointCount * sizeof(double));
+  const size_t yPad = idsOffset - (header.YsOffset + pointCount * sizeof(double));
+  uint64_t sum = CHECKSUM_BASIS;
+  sum = checksum(sum, nodes, nodeCount * sizeof(SnapshotNode));
+  sum = checksum(sum, zeros, nodePad);
+  sum = checksum(sum, xs, pointCount * sizeof(double));
+  sum = checksum(sum, zeros, xPad);
+  sum = checksum(sum, ys, pointCount * sizeof(double));
+  sum = checksum(sum, zeros, yPad);
+  sum = checksum(sum, ids, pointCount * sizeof(uint64_t));
+  header.Checksum = sum;
+
+  // written aside and renamed into place, so a reader never maps half a file
+  const std::string partial = path + ".partial";
+  {
+    std::ofstream out(partial.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(nodes), nodeCount * sizeof(SnapshotNode));
+    out.write(zeros, nodePad);
+    out.write(reinterpret_cast<const char*>(xs), pointCount * sizeof(double));
+    out.write(zeros, xPad);
+    out.write(reinterpret_cast<const char*>(ys), pointCount * sizeof(double));
+    out.write(zeros, yPad);
+    out.write(reinterpret_cast<const char*>(ids), pointCount * sizeof(uint64_t));
+    out.close();
+    if(!out)
+    {
+      std::remove(partial.c_str());
+      return false;
+    }
+  }
+  return std::rename(partial.c_str(), path.c_str()) == 0;
+}
+
+std::unique_ptr<Snapshot> Snapshot::Map(const std::string& path, bool verify)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return nullptr;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(FileHeader))
+  {
+    close(fd);
+    return nullptr;
+  }
+  const uint64_t size = st.st_size;
+  void* base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps the file
+  if(base == MAP_FAILED)
+    return nullptr;
+
+  std::unique_ptr<Snapshot> s(new Snapshot());
+  s->mapping = base;
+  s->mappingBytes = size;
+
+  FileHeader header;
+  std::memcpy(&header, base, sizeof(header));
+  if(std::memcmp(header.Magic, MAGIC, sizeof(MAGIC)) != 0 || header.Version != VERSION || header.Endian != ENDIAN)
+    return nullptr;
+  // every section in order, inside the file, and the file no longer than the last one
+  if(header.NodeCount == 0 || header.NodesOffset != SECTION_ALIGN
+     || header.NodeCount > size / sizeof(SnapshotNode) || header.PointCount > size / sizeof(double)
+     || header.XsOffset != aligned(header.NodesOffset + header.NodeCount * sizeof(SnapshotNode))
+     || header.YsOffset != aligned(header.XsOffset + header.PointCount * sizeof(double))
+     || aligned(header.YsOffset + header.PointCount * sizeof(double)) + header.PointCount * sizeof(uint64_t) != size)
+    return nullptr;
+
+  const char* bytes = static_cast<const char*>(base);
+  s->nodes = reinterpret_cast<const SnapshotNode*>(bytes + header.NodesOffset);
+  s->xs = reinterpret_cast<const double*>(bytes + header.XsOffset);
+  s->ys = reinterpret_cast<const double*>(bytes + header.YsOffset);
+  s->ids = reinterpret_cast<const uint64_t*>(bytes + aligned(header.YsOffset + header.PointCount * sizeof(double)));
+  s->nodeCount = header.NodeCount;
+  s->pointCount = header.PointCount;
+  if(verify && (checksum(CHECKSUM_BASIS, bytes + sizeof(FileHeader), size - sizeof(FileHeader)) != header.Checksum
+                || !indicesValid(s->nodes, s->nodeCount, s->pointCount)))
+    return nullptr;
+  return s;
+}
+
+/// A subtree wholly inside r is emitted as one range, without testing its points or visiting its nodes.
+template <typename Region, typename Emit>
+void Snapshot::query(const SnapshotNode& node, const Region& r, Emit& emit) const
+{
+  if(!r.Intersects(node.Boundary))
+    return;
+  if(node.Children == 0 || r.Contains(node.Boundary))
+  {
+    filter::ForEachInside(xs + node.Begin, ys + node.Begin, ids + node.Begin, node.End - node.Begin, r, node.Boundary, emit);
+    return;
+  }
+  for(size_t c = node.Children; c != node.Children + 4; ++c)
+    query(nodes[c], r, emit);
+}
+
+void Snapshot::Query(const BoundingBox& b, vector<Point>& found) const
+{
+  const auto emit = [&found] (const Point& p) {found.push_back(p);};
+  query(nodes[0], b, emit);
+}
+
+void Snapshot::Query(const BoundingBox& b, const PointVisitor& visit) const
+{
+  query(nodes[0], b, visit);
+}
+
+void Snapshot::Query(const Circle& c, vector<Point>& found) const
+{
+  const auto emit = [&found] (const Point& p) {found.push_back(p);};
+  query(nodes[0], c, emit);
+}
+
+void Snapshot::Query(const ConvexPolygon& c, vector<Point>& found) const
+{
+  const auto emit = [&found] (const Point& p) {found.push_back(p);};
+  query(nodes[0], c, emit);
+}
+
+void Snapshot::QueryIDs(const BoundingBox& b, vector<uint64_t>& found) const
+{
+  const auto emit = [&found] (const Point& p) {found.push_back(p.ID);};
+  query(nodes[0], b, emit);
+}
+
+size_t Snapshot::Count(const BoundingBox& b) const
+{
+  return tally(nodes[0], b);
+}
+
+size_t Snapshot::tally(const SnapshotNode& node, const BoundingBox& b) const
+{
+  if(!node.Boundary.Intersects(b))
+    return 0;
+  if(b.Contains(node.Boundary))
+    return node.End - node.Begin;
+  if(node.Children == 0)
+  {
+    size_t n = 0;
+    const auto tick = [&n] (const Point&) {++n;};
+    filter::ForEachContained(xs + node.Begin, ys + node.Begin, ids + node.Begin, node.End - node.Begin, b, node.Boundary, tick);
+    return n;
+  }
+  size_t n = 0;
+  for(size_t c = node.Children; c != node.Children + 4; ++c)
+    n += tally(nodes[c], b);
+  return n;
+}
+
+vector<Point> Snapshot::Nearest(const Point& p, size_t k) const
+{
+  NearestPoints best(p, k);
+  if(k == 0)
+    return best.Take();
+  NearestQueue<const SnapshotNode> queue;
+  queue.push({DistanceSquared(p, nodes[0].Boundary), nodes});
+  while(!queue.empty() && queue.top().Distance < best.Worst())
+  {
+    const SnapshotNode* node = queue.top().N;
+    queue.pop();
+    if(node->Children == 0)
+    {
+      for(size_t i = node->Begin; i != node->End; ++i)
+        best.Offer(xs[i], ys[i], ids[i]);
+      continue;
+    }
+    for(size_t c = node->Children; c != node->Children + 4; ++c)
+    {
+      if(nodes[c].Begin != nodes[c].End)
+        queue.push({DistanceSquared(p, nodes[c].Boundary), &nodes[c]});
+    }
+  }
+  return best.Take();
+}
+}
@@ -0,0 +1,93 @@
+#ifndef snapshotH
+#define snapshotH
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <string>
+#include "quadtree.h"
+#include "nearest.h"
+
+namespace quadtree
+{
+/// A node of a Snapshot. Plain data, with indices instead of pointers, so it's written to and mapped from files as is.
+struct SnapshotNode
+{
+  BoundingBox Boundary;
+  uint64_t Begin;    ///< the subtree's points are [Begin, End) of the snapshot's point arrays
+  uint64_t End;
+  uint64_t Children; ///< index of the first of four consecutive children, in Quadrant() order; 0 for a leaf
+};
+
+/// An immutable quadtree, for read-mostly traffic: no atomics, locks or reclamation on any read.
+/// Nodes are in one array, in breadth-first order. Points are in Morton order, X, Y and ID in separate arrays,
+/// so every subtree's points are one contiguous range, and a box covering a whole subtree is one copy or one subtraction.
+/// Points are placed the same way the live trees place them, in the first quadrant that contains them,
+/// so queries find exactly what they'd find in the tree it was frozen from.
+class Snapshot
+{
+public:
+  /// @param capacity the most points in a leaf, short of the limit of double precision
+  /// @param threads for the Morton sort. 0 for one per hardware thread.
+  static std::unique_ptr<Snapshot> Build(const std::vector<Point>& points, BoundingBox boundary, size_t capacity, unsigned int threads = 0);
+  /// Serves a snapshot straight from a file Write() made, mapped read-only. Nothing is copied or parsed;
+  /// pages are read in as queries touch them.
+  /// @param verify checksum the file and check every node's indices first, which reads all of it.
+  ///               Without it only the header is checked, and a corrupt file gives wrong answers or worse.
+  /// @return nullptr if the file can't be mapped, or isn't a snapshot this build can read
+  static std::unique_ptr<Snapshot> Map(const std::string& path, bool verify = true);
+  ~Snapshot();
+
+  /// writes the snapshot to path, for Map(). The file only appears once it's complete.
+  /// @return false if it couldn't be written
+  bool Write(const std::string& path) const;
+
+  /// appends the points inside the box to found
+  void Query(const BoundingBox& b, std::vector<Point>& found) const;
+  void Query(const BoundingBox& b, const PointVisitor& visit) const;
+  std::vector<Point> Query(const BoundingBox& b) const
+  {
+    std::vector<Point> found;
+    Query(b, found);
+    return found;
+  }
+  /// appends the points inside the circle, or the polygon, to found
+  void Query(const Circle& c, std::vector<Point>& found) const;
+  void Query(const ConvexPolygon& c, std::vector<Point>& found) const;
+  /// appends the IDs of the points inside the box to found
+  void QueryIDs(const BoundingBox& b, std::vector<uint64_t>& found) const;
+  size_t Count(const BoundingBox& b) const;
+  /// @return the k points closest to p, nearest first
+  std::vector<Point> Nearest(const Point& p, size_t k) const;
+  BoundingBox Boundary() const {return nodes[0].Boundary;}
+  /// @return the number of points
+  size_t Size() const {return pointCount;}
+  size_t Nodes() const {return nodeCount;}
+
+private:
+  Snapshot();
+  Snapshot(const Snapshot&);
+  Snapshot& operator=(const Snapshot&);
+
+  /// @param r a BoundingBox, Circle or ConvexPolygon
+  template <typename Region, typename Emit>
+  void query(const SnapshotNode& node, const Region& r, Emit& emit) const;
+  size_t tally(const SnapshotNode& node, const BoundingBox& b) const;
+
+  /// the arrays queries read, in the stores below or in the mapping
+  const SnapshotNode* nodes;
+  const double* xs;
+  const double* ys;
+  const uint64_t* ids;
+  size_t nodeCount;
+  size_t pointCount;
+
+  std::vector<SnapshotNode> nodeStore;
+  std::vector<double> xStore;
+  std::vector<double> yStore;
+  std::vector<uint64_t> idStore;
+  void* mapping;
+  size_t mappingBytes;
+};
+}
+#endif // snapshotH
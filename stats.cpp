@@ -0,0 +1,110 @@
+#include <mutex>
+#include "stats.h"
+#include "reclaim.h"
+
+namespace
+{
+using quadtree::stats::Block;
+using quadtree::stats::COUNTERS;
+
+/// live blocks, and what exited threads counted. Only touched on thread start and exit, and by ReadStats().
+std::mutex blocksMutex;
+Block* blocks = nullptr;
+uint64_t exited[COUNTERS];
+
+/// the Stats field for each Counter
+uint64_t quadtree::Stats::* const FIELDS[COUNTERS] = {
+  &quadtree::Stats::InsertCasFailures,
+  &quadtree::Stats::SubdivisionsStarted,
+  &quadtree::Stats::SubdivisionsHelped,
+  &quadtree::Stats::DisperseMoves,
+  &quadtree::Stats::Compactions,
+  &quadtree::Stats::Merges,
+  &quadtree::Stats::QueryRestarts,
+  &quadtree::Stats::QueryHelps,
+  &quadtree::Stats::HazardAcquires,
+  &quadtree::Stats::Retired,
+  &quadtree::Stats::Freed,
+};
+
+const char* const NAMES[COUNTERS] = {
+  "insert CAS failures",
+  "subdivisions started",
+  "subdivisions helped",
+  "disperse moves",
+  "compactions",
+  "merges",
+  "query restarts",
+  "query helps",
+  "hazard pointer acquisitions",
+  "retired",
+  "freed",
+};
+}
+
+namespace quadtree
+{
+namespace stats
+{
+thread_local Block block;
+
+Block::Block()
+{
+  for(auto& c : Counts)
+    c.store(0);
+  std::lock_guard<std::mutex> lock(blocksMutex);
+  Next = blocks;
+  blocks = this;
+}
+
+Block::~Block()
+{
+  std::lock_guard<std::mutex> lock(blocksMutex);
+  for(size_t i = 0; i != COUNTERS; ++i)
+    exited[i] += Counts[i].load();
+  for(Block** b = &blocks; *b != nullptr; b = &(*b)->Next)
+  {
+    if(*b == this)
+    {
+      *b = Next;
+      break;
+    }
+  }
+}
+}
+
+Stats Stats::operator-(const Stats& before) const
+{
+  Stats s = *this;
+  for(auto field : FIELDS)
+    s.*field -= before.*field;
+  return s;
+}
+
+std::string Stats::String() const
+{
+  std::string s;
+  for(size_t i = 0; i != COUNTERS; ++i)
+    s += std::string(NAMES[i]) + ": " + std::to_string(this->*FIELDS[i]) + "\n";
+  s += "hazard pointer list length: " + std::to_string(HazardListLength) + "\n";
+  return s;
+}
+
+Stats ReadStats()
+{
+  Stats s = Stats();
+  {
+    std::lock_guard<std::mutex> lock(blocksMutex);
+    for(size_t i = 0; i != COUNTERS; ++i)
+    {
+      uint64_t total = exited[i];
+      for(const stats::Block* b = blocks; b != nullptr; b = b->Next)
+        total += b->Counts[i].load(std::memory_order_relaxed);
+      s.*FIELDS[i] = total;
+    }
+  }
+  for(HazardPointer* p = HazardPointer::Head(); p != nullptr; p = p->Next)
+    ++s.HazardListLength;
+  return s;
+}
+}
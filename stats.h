@@ -0,0 +1,84 @@
+#ifndef statsH
+#define statsH
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/// Build with -DQUADTREE_STATS=0 to compile the counters out of the hot paths entirely.
+#ifndef QUADTREE_STATS
+#define QUADTREE_STATS 1
+#endif
+
+namespace quadtree
+{
+/// Totals of the lock-free tree's hot path counters, summed over every thread that has ever run.
+struct Stats
+{
+  uint64_t InsertCasFailures;
+  uint64_t SubdivisionsStarted;
+  uint64_t SubdivisionsHelped;
+  uint64_t DisperseMoves;
+  uint64_t Compactions;
+  uint64_t Merges;
+  uint64_t QueryRestarts;
+  uint64_t QueryHelps;
+  uint64_t HazardAcquires;
+  uint64_t HazardListLength; ///< not a counter: the length of the hazard pointer list when the stats were read
+  uint64_t Retired;
+  uint64_t Freed;
+
+  /// @return the counts since before was read. HazardListLength is kept as is.
+  Stats operator-(const Stats& before) const;
+  std::string String() const;
+};
+
+/// @return the current totals. All zero, except HazardListLength, when QUADTREE_STATS is 0.
+Stats ReadStats();
+
+namespace stats
+{
+enum Counter
+{
+  InsertCasFailures,
+  SubdivisionsStarted,
+  SubdivisionsHelped,
+  DisperseMoves,
+  Compactions,
+  Merges,
+  QueryRestarts,
+  QueryHelps,
+  HazardAcquires,
+  Retired,
+  Freed,
+  COUNTERS
+};
+
+/// One thread's counters. Only the owning thread writes them, so they're bumped with a plain load and store.
+struct Block
+{
+  Block();
+  ~Block(); ///< folds the counts into the totals of exited threads
+  std::atomic<uint64_t> Counts[COUNTERS];
+  Block* Next;
+};
+
+extern thread_local Block block;
+
+inline void Increment(Counter c, uint64_t n = 1)
+{
+  std::atomic<uint64_t>& count = block.Counts[c];
+  count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+}
+}
+
+#if QUADTREE_STATS
+#define QUADTREE_COUNT(counter) ::quadtree::stats::Increment(::quadtree::stats::counter)
+#define QUADTREE_COUNT_N(counter, n) ::quadtree::stats::Increment(::quadtree::stats::counter, (n))
+#else
+#define QUADTREE_COUNT(counter) do {} while(0)
+#define QUADTREE_COUNT_N(counter, n) do {} while(0)
+#endif
+
+#endif // statsH
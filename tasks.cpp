@@ -0,0 +1,113 @@
+#include <algorithm>
+#include "tasks.h"
+
+namespace quadtree
+{
+TaskPool::TaskPool(unsigned int threads_)
+  : pending(0)
+  , generation(0)
+  , stopping(false)
+{
+  if(threads_ == 0)
+    threads_ = std::max(std::thread::hardware_concurrency(), 1u);
+  for(unsigned int i = 0; i != threads_; ++i)
+    queues.push_back(std::unique_ptr<Queue>(new Queue()));
+  // worker 0 is whoever calls Run()
+  for(unsigned int i = 1; i != threads_; ++i)
+    threads.push_back(std::thread([this, i] () {work(i);}));
+}
+
+TaskPool::~TaskPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for(auto& t : threads)
+    t.join();
+}
+
+void TaskPool::Run(Task task)
+{
+  std::lock_guard<std::mutex> running(runMutex);
+  pending.store(1);
+  {
+    std::lock_guard<std::mutex> lock(queues[0]->Mutex);
+    queues[0]->Tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    ++generation;
+  }
+  wake.notify_all();
+  drain(0);
+}
+
+void TaskPool::Spawn(unsigned int worker, Task task)
+{
+  pending.fetch_add(1);
+  std::lock_guard<std::mutex> lock(queues[worker]->Mutex);
+  queues[worker]->Tasks.push_back(std::move(task));
+}
+
+bool TaskPool::next(unsigned int worker, Task& task)
+{
+  {
+    Queue& own = *queues[worker];
+    std::lock_guard<std::mutex> lock(own.Mutex);
+    if(!own.Tasks.empty())
+    {
+      task = std::move(own.Tasks.back());
+      own.Tasks.pop_back();
+      return true;
+    }
+  }
+  for(size_t i = 1; i != queues.size(); ++i)
+  {
+    Queue& victim = *queues[(worker + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.Mutex);
+    if(!victim.Tasks.empty())
+    {
+      task = std::move(victim.Tasks.front());
+      victim.Tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+/// A worker with nothing to run keeps looking until the count says the Run is over,
+/// since a task still running elsewhere may yet spawn more.
+void TaskPool::drain(unsigned int worker)
+{
+  Task task;
+  while(pending.load() != 0)
+  {
+    if(!next(worker, task))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    task(worker);
+    task = nullptr;
+    pending.fetch_sub(1);
+  }
+}
+
+void TaskPool::work(unsigned int worker)
+{
+  uint64_t seen = 0;
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [this, seen] () {return stopping || generation != seen;});
+      if(stopping)
+        return;
+      seen = generation;
+    }
+    drain(worker);
+  }
+}
+}
@@ -0,0 +1,63 @@
+#ifndef tasksH
+#define tasksH
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+
+namespace quadtree
+{
+/// A fixed set of worker threads that share out a tree of tasks by work stealing.
+/// Each worker has its own deque. It pushes and pops its own tasks at the back, so it works depth-first on what it
+/// spawned last, while an idle worker steals from the front of another's, where the oldest and biggest tasks are.
+class TaskPool
+{
+public:
+  /// @param worker the index of the worker running the task, for per-worker scratch space
+  typedef std::function<void(unsigned int worker)> Task;
+
+  /// @param threads workers, counting the thread that calls Run(). 0 for one per hardware thread.
+  explicit TaskPool(unsigned int threads = 0);
+  ~TaskPool();
+
+  unsigned int Size() const {return static_cast<unsigned int>(queues.size());}
+  /// Runs task and everything it spawns, and returns once they're all done. The calling thread works too, as worker 0.
+  /// One Run at a time; concurrent calls wait their turn.
+  void Run(Task task);
+  /// From inside a task: queues another, for this worker or a thief.
+  void Spawn(unsigned int worker, Task task);
+
+private:
+  TaskPool(const TaskPool&);
+  TaskPool& operator=(const TaskPool&);
+
+  struct Queue
+  {
+    std::mutex Mutex;
+    std::deque<Task> Tasks;
+  };
+
+  /// @return false if there's nothing to run, in worker's queue or anyone else's
+  bool next(unsigned int worker, Task& task);
+  /// runs tasks until everything in the current Run is done
+  void drain(unsigned int worker);
+  void work(unsigned int worker);
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  /// tasks spawned and not yet finished, in the current Run
+  std::atomic<size_t> pending;
+  std::mutex runMutex;
+
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  uint64_t generation; ///< Runs started. Guarded by sleepMutex.
+  bool stopping;       ///< guarded by sleepMutex
+};
+}
+#endif // tasksH